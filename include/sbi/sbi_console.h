@@ -58,6 +58,27 @@ void sbi_console_set_device(const struct sbi_console_device *dev);
 
 struct sbi_scratch;
 
+#ifdef CONFIG_SBI_CONSOLE_ASYNC
+
+/** Write out all buffered output if the device is not busy */
+void sbi_console_drain(void);
+
+/** Write out all buffered output, waiting for the device if needed */
+void sbi_console_flush(void);
+
+int sbi_console_async_init(struct sbi_scratch *scratch, bool cold_boot);
+
+#else
+
+static inline void sbi_console_drain(void) { }
+
+static inline void sbi_console_flush(void) { }
+
+static inline int sbi_console_async_init(struct sbi_scratch *scratch,
+					 bool cold_boot) { return 0; }
+
+#endif
+
 #define SBI_ASSERT(cond, args) do { \
 	if (unlikely(!(cond))) \
 		sbi_panic args; \
@@ -95,6 +95,8 @@ void sbi_ecall_unregister_extension(struct sbi_ecall_extension *ext);
 
 int sbi_ecall_handler(struct sbi_trap_context *tcntx);
 
+struct sbi_trap_regs *sbi_ecall_fast_handler(struct sbi_trap_regs *regs);
+
 int sbi_ecall_init(void);
 
 #endif
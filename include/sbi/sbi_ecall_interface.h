@@ -39,6 +39,10 @@
 #define SBI_EXT_FWFT				0x46574654
 #define SBI_EXT_MPXY				0x4D505859
 
+/* Experimental extension IDs */
+#define SBI_EXT_RFENCE_BATCH			0x08524642
+#define SBI_EXT_PMU_MUX				0x08504D58
+
 /* SBI function IDs for BASE extension*/
 #define SBI_EXT_BASE_GET_SPEC_VERSION		0x0
 #define SBI_EXT_BASE_GET_IMP_ID			0x1
@@ -266,6 +270,18 @@ struct sbi_pmu_event_info {
 	uint64_t event_data;
 };
 
+/** SBI PMU counter snapshot shared memory layout */
+struct sbi_pmu_snapshot {
+	/* Overflown counters relative to counter_idx_base */
+	uint64_t ctr_overflow_mask;
+	/* Counter values relative to counter_idx_base */
+	uint64_t ctr_values[64];
+	uint64_t reserved[447];
+};
+
+#define SBI_PMU_SNAPSHOT_SHMEM_SIZE	4096
+#define SBI_PMU_SNAPSHOT_SHMEM_ALIGN_MASK	(SBI_PMU_SNAPSHOT_SHMEM_SIZE - 1)
+
 /* Helper macros to decode event idx */
 #define SBI_PMU_EVENT_IDX_MASK 0xFFFFF
 #define SBI_PMU_EVENT_IDX_TYPE_OFFSET 16
@@ -478,6 +494,48 @@ enum sbi_sse_state {
 #define SBI_MPXY_NOTIF_HDR_LOST_OFFSET		0x08
 #define SBI_MPXY_NOTIF_HDR_RESERVED_OFFSET	0x0C
 
+/* SBI function IDs for experimental batched RFENCE extension */
+#define SBI_EXT_RFENCE_BATCH_REMOTE_FENCE	0x0
+
+/**
+ * Batched RFENCE shared memory entry
+ *
+ * The fid field takes one of the SBI_EXT_RFENCE_REMOTE_* function IDs
+ * and id carries the ASID or VMID argument of that function (if any).
+ */
+struct sbi_rfence_batch_entry {
+	unsigned long fid;
+	unsigned long start;
+	unsigned long size;
+	unsigned long id;
+};
+
+/* SBI function IDs for experimental PMU multiplexing extension */
+#define SBI_EXT_PMU_MUX_SET_SHMEM		0x0
+#define SBI_EXT_PMU_MUX_START			0x1
+#define SBI_EXT_PMU_MUX_STOP			0x2
+
+/** Maximum number of events in one multiplexed event set */
+#define SBI_PMU_MUX_MAX_EVENTS			64
+/** Minimum rotation period of a multiplexed event set in microseconds */
+#define SBI_PMU_MUX_MIN_PERIOD_US		100
+
+/**
+ * Multiplexed PMU event set shared memory entry
+ *
+ * event_idx, cfg_flags and event_data take the same values as the
+ * arguments of SBI_EXT_PMU_COUNTER_CFG_MATCH. value and time_running
+ * (in timer ticks) are accumulated by the SBI implementation whenever
+ * the event is rotated out.
+ */
+struct sbi_pmu_mux_event {
+	uint32_t event_idx;
+	uint32_t cfg_flags;
+	uint64_t event_data;
+	uint64_t value;
+	uint64_t time_running;
+};
+
 /* SBI base specification related macros */
 #define SBI_SPEC_VERSION_MAJOR_OFFSET		24
 #define SBI_SPEC_VERSION_MAJOR_MASK		0x7f
@@ -95,6 +95,8 @@ enum sbi_hart_extensions {
 	SBI_HART_EXT_F,
 	/** Hart has D extension */
 	SBI_HART_EXT_D,
+	/** Hart has Svinval extension */
+	SBI_HART_EXT_SVINVAL,
 
 	/** Maximum index of Hart extension */
 	SBI_HART_EXT_MAX,
@@ -76,6 +76,14 @@ static inline unsigned long sbi_heap_free_space(void)
 	return sbi_heap_free_space_from(&global_hpctrl);
 }
 
+/** Size (in bytes) of the largest free block in the heap area */
+unsigned long sbi_heap_largest_free_space_from(struct sbi_heap_control *hpctrl);
+
+static inline unsigned long sbi_heap_largest_free_space(void)
+{
+	return sbi_heap_largest_free_space_from(&global_hpctrl);
+}
+
 /** Amount (in bytes) of used space in the heap area */
 unsigned long sbi_heap_used_space_from(struct sbi_heap_control *hpctrl);
 
@@ -92,6 +100,41 @@ static inline unsigned long sbi_heap_reserved_space(void)
 	return sbi_heap_reserved_space_from(&global_hpctrl);
 }
 
+/** Statistics of the per-HART object caches of the global heap */
+struct sbi_heap_cache_stats {
+	/** Allocations served from the cache */
+	unsigned long hits;
+	/** Batches of objects moved from the heap into the cache */
+	unsigned long refills;
+	/** Batches of objects moved from the cache back to the heap */
+	unsigned long flushes;
+	/** Bytes currently held in the cache */
+	unsigned long cached;
+	/** Largest number of bytes held in the cache */
+	unsigned long high_water;
+};
+
+/** Sum of the per-HART object cache statistics of all HARTs */
+void sbi_heap_cache_stats(struct sbi_heap_cache_stats *stats);
+
+#ifdef CONFIG_SBI_HEAP_PROFILE
+
+/** Account an allocation of the global heap to its call site */
+void sbi_heap_profile_record(unsigned long caller, size_t size,
+			     size_t granted);
+
+/** Print the heap usage per call site and the fragmentation */
+void sbi_heap_profile_print(void);
+
+#else
+
+static inline void sbi_heap_profile_record(unsigned long caller, size_t size,
+					   size_t granted) { }
+
+static inline void sbi_heap_profile_print(void) { }
+
+#endif
+
 /** Initialize heap area */
 int sbi_heap_init(struct sbi_scratch *scratch);
 int sbi_heap_init_new(struct sbi_heap_control *hpctrl, unsigned long base,
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_HOTPC_H__
+#define __SBI_HOTPC_H__
+
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_types.h>
+
+struct sbi_scratch;
+
+/** Kinds of software emulation tracked per PC */
+enum sbi_hotpc_kind {
+	SBI_HOTPC_ILLEGAL_INSN = 0,
+	SBI_HOTPC_MISALIGNED_LOAD,
+	SBI_HOTPC_MISALIGNED_STORE,
+	SBI_HOTPC_KIND_MAX,
+};
+
+#ifdef CONFIG_SBI_HOTPC
+
+static inline unsigned long sbi_hotpc_start(void)
+{
+	return csr_read(CSR_MCYCLE);
+}
+
+/** Account one emulation of the given kind at @pc started at @start */
+void sbi_hotpc_record(enum sbi_hotpc_kind kind, unsigned long pc,
+		      unsigned long start);
+
+/** Print the hottest emulated PCs of all harts on the console */
+void sbi_hotpc_dump(void);
+
+int sbi_hotpc_init(struct sbi_scratch *scratch, bool cold_boot);
+
+#else
+
+static inline unsigned long sbi_hotpc_start(void) { return 0; }
+
+static inline void sbi_hotpc_record(enum sbi_hotpc_kind kind,
+				    unsigned long pc,
+				    unsigned long start) { }
+
+static inline void sbi_hotpc_dump(void) { }
+
+static inline int sbi_hotpc_init(struct sbi_scratch *scratch,
+				 bool cold_boot) { return 0; }
+
+#endif
+
+#endif
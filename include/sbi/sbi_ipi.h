@@ -53,12 +53,24 @@ struct sbi_ipi_event_ops {
 	 * @return < 0, error or failure
 	 * @return SBI_IPI_UPDATE_SUCCESS, success
 	 * @return SBI_IPI_UPDATE_BREAK, break IPI, done on local hart
-	 * @return SBI_IPI_UPDATE_RETRY, need retry
+	 * @return SBI_IPI_UPDATE_RETRY, need retry (the remote HART is
+	 * still interrupted so that it can drain a partial update)
 	 */
 	int (* update)(struct sbi_scratch *scratch,
 			struct sbi_scratch *remote_scratch,
 			u32 remote_hartindex, void *data);
 
+	/**
+	 * Wait callback to park until remote HART can accept more data
+	 * Note: This is an optional callback and it is called after update
+	 * returned SBI_IPI_UPDATE_RETRY, just before calling update again
+	 * for the same remote HART. It should return once the remote HART
+	 * has made room and should keep servicing the local HART's own
+	 * pending work while waiting to avoid deadlocks.
+	 */
+	void (* wait)(struct sbi_scratch *scratch,
+		      struct sbi_scratch *remote_scratch);
+
 	/**
 	 * Sync callback to wait for remote HART
 	 * Note: This is an optional callback and it is called just after
@@ -0,0 +1,78 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_MINHEAP_H__
+#define __SBI_MINHEAP_H__
+
+#include <sbi/sbi_types.h>
+
+/**
+ * Intrusive binary min-heap ordered by a 64-bit key.
+ *
+ * Nodes are embedded in the objects they order and linked as a complete
+ * binary tree, so no storage has to be allocated when inserting. Insert
+ * and remove of an arbitrary node are O(log n), looking up the node
+ * with the smallest key is O(1). Nodes with equal keys are returned in
+ * no particular order.
+ *
+ * The heap does no locking, callers must serialize all operations.
+ */
+struct sbi_minheap_node {
+	struct sbi_minheap_node *parent;
+	struct sbi_minheap_node *left;
+	struct sbi_minheap_node *right;
+	u64 key;
+};
+
+struct sbi_minheap {
+	/** Node with the smallest key */
+	struct sbi_minheap_node *root;
+	/** Number of nodes in the heap */
+	unsigned long count;
+};
+
+#define SBI_INIT_MINHEAP(__ptr)				\
+do {							\
+	(__ptr)->root = NULL;				\
+	(__ptr)->count = 0;				\
+} while (0)
+
+#define SBI_INIT_MINHEAP_NODE(__ptr)			\
+do {							\
+	(__ptr)->parent = NULL;				\
+	(__ptr)->left = NULL;				\
+	(__ptr)->right = NULL;				\
+	(__ptr)->key = 0;				\
+} while (0)
+
+static inline bool sbi_minheap_empty(const struct sbi_minheap *h)
+{
+	return !h->root;
+}
+
+/** Check whether a node is on the given heap */
+static inline bool sbi_minheap_node_linked(const struct sbi_minheap *h,
+					   const struct sbi_minheap_node *node)
+{
+	return node->parent || h->root == node;
+}
+
+/** Get the node with the smallest key or NULL if the heap is empty */
+static inline struct sbi_minheap_node *sbi_minheap_first(
+					const struct sbi_minheap *h)
+{
+	return h->root;
+}
+
+/** Insert a node which is not on any heap using its current key */
+void sbi_minheap_insert(struct sbi_minheap *h, struct sbi_minheap_node *node);
+
+/** Remove a node from the heap it is on */
+void sbi_minheap_remove(struct sbi_minheap *h, struct sbi_minheap_node *node);
+
+/** Change the key of a node on the heap and restore the heap order */
+void sbi_minheap_update(struct sbi_minheap *h, struct sbi_minheap_node *node,
+			u64 key);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_MPSC_H__
+#define __SBI_MPSC_H__
+
+#include <sbi/riscv_atomic.h>
+#include <sbi/sbi_types.h>
+
+/**
+ * Bounded lock-free queue which can be filled by any number of harts
+ * and drained by exactly one hart (the owner).
+ *
+ * Every slot carries a sequence number which tells producers and the
+ * consumer whether the slot is free, being written or ready to be read.
+ * Producers claim slots with a compare-and-swap on the head position,
+ * the consumer never writes the head and producers never write the tail,
+ * so no lock is required on either side.
+ *
+ * The number of entries must be a power of two.
+ */
+struct sbi_mpsc {
+	/** Entry storage (num_entries * entry_size bytes) */
+	void *queue;
+	/** Per-slot sequence numbers (num_entries longs) */
+	volatile unsigned long *seq;
+	/** Size of one entry in bytes */
+	u32 entry_size;
+	/** Number of entries (power of two) */
+	u32 num_entries;
+	/** Next position to be claimed by a producer */
+	atomic_t head;
+	/** Next position to be read by the consumer */
+	unsigned long tail;
+};
+
+/**
+ * Get the amount of memory required by sbi_mpsc_init() for the given
+ * geometry. The number of entries is rounded up to a power of two.
+ */
+unsigned long sbi_mpsc_mem_size(u32 entries, u32 entry_size);
+
+int sbi_mpsc_init(struct sbi_mpsc *q, void *mem, u32 entries, u32 entry_size);
+
+/** Can be called concurrently from any hart */
+int sbi_mpsc_enqueue(struct sbi_mpsc *q, void *data);
+
+/** Must only be called by the consumer hart */
+int sbi_mpsc_dequeue(struct sbi_mpsc *q, void *data);
+
+/** Can be called from any hart */
+bool sbi_mpsc_is_full(struct sbi_mpsc *q);
+
+/** Must only be called by the consumer hart */
+bool sbi_mpsc_is_empty(struct sbi_mpsc *q);
+
+#endif
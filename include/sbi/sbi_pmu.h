@@ -10,10 +10,12 @@
 #ifndef __SBI_PMU_H__
 #define __SBI_PMU_H__
 
+#include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_types.h>
 #include <sbi/sbi_trap.h>
 
 struct sbi_scratch;
+struct sbi_pmu_context;
 
 /* Event related macros */
 /* Maximum number of hardware events that can mapped by OpenSBI */
@@ -26,6 +28,40 @@ struct sbi_scratch;
 #define SBI_PMU_FIXED_CTR_MASK 0x07
 #define SBI_PMU_CY_IR_MASK	0x05
 
+/**
+ * OpenSBI internal firmware events
+ *
+ * These are counted on SBI_PMU_FW_PLATFORM counters configured with
+ * event_data set to one of the IDs below in bits [7:0]. Events taking
+ * parameters encode them in the upper bits of event_data. They are only
+ * available when the platform PMU device does not provide custom
+ * firmware events.
+ */
+enum sbi_pmu_fw_internal_event_id {
+	/** Queued TLB flush requests folded into another request */
+	SBI_PMU_FW_INTERNAL_TLB_MERGED = 0,
+	/** Coalesced TLB flush ranges promoted to a full flush */
+	SBI_PMU_FW_INTERNAL_TLB_PROMOTED,
+	/** Traps of a given cause handled within a latency bucket */
+	SBI_PMU_FW_INTERNAL_TRAP_LATENCY,
+	/** Ecalls of a given EID/FID handled within a latency bucket */
+	SBI_PMU_FW_INTERNAL_ECALL_LATENCY,
+	SBI_PMU_FW_INTERNAL_MAX,
+};
+
+#define SBI_PMU_FW_INTERNAL_ID(__edata)		((__edata) & 0xff)
+
+/**
+ * event_data of the latency events: bits [15:8] are the log2 latency
+ * bucket, bits [31:16] the trap cause (bit 31 set for interrupts) or the
+ * ecall FID and bits [63:32] the ecall EID.
+ */
+#define SBI_PMU_FW_INTERNAL_LATENCY_DATA(__id, __bucket, __key, __eid) \
+	((u64)(__id) | ((u64)(__bucket) << 8) | \
+	 ((u64)((__key) & 0xffff) << 16) | ((u64)(__eid) << 32))
+#define SBI_PMU_FW_INTERNAL_BUCKET(__edata)	(((__edata) >> 8) & 0xff)
+#define SBI_PMU_FW_INTERNAL_EID(__edata)	((__edata) >> 32)
+
 struct sbi_pmu_device {
 	/** Name of the PMU platform device */
 	char name[32];
@@ -111,6 +147,18 @@ int sbi_pmu_init(struct sbi_scratch *scratch, bool cold_boot);
 /** Reset PMU during hart exit */
 void sbi_pmu_exit(struct sbi_scratch *scratch);
 
+/**
+ * Switch the PMU state of the current HART between two domain contexts
+ *
+ * The counters of the current domain are only saved, and the counters
+ * of the target domain only restored, if the respective domain has
+ * counters configured or a snapshot shared memory registered. The
+ * context of the current domain is allocated on its first save which
+ * finds the PMU in use, a NULL target context holds nothing to restore.
+ */
+void sbi_pmu_context_switch(struct sbi_pmu_context **save,
+			    struct sbi_pmu_context *restore);
+
 /** Return the pmu irq bit depending on extension existence */
 int sbi_pmu_irq_bit(void);
 
@@ -138,6 +186,9 @@ int sbi_pmu_add_raw_event_counter_map(uint64_t select, uint64_t select_mask, u32
 
 int sbi_pmu_ctr_fw_read(unsigned long cidx, uint64_t *cval, bool high_bits);
 
+/** Read the current value of a configured counter of the current HART */
+int sbi_pmu_ctr_read(unsigned long cidx, uint64_t *cval);
+
 int sbi_pmu_ctr_stop(unsigned long cidx_base, unsigned long cidx_mask,
 		     unsigned long flag);
 
@@ -148,6 +199,9 @@ int sbi_pmu_ctr_get_info(uint32_t cidx, unsigned long *ctr_info);
 int sbi_pmu_event_get_info(unsigned long shmem_lo, unsigned long shmem_high,
 						   unsigned long num_events, unsigned long flags);
 
+int sbi_pmu_snapshot_set_shmem(unsigned long shmem_lo, unsigned long shmem_hi,
+			       unsigned long flags);
+
 unsigned long sbi_pmu_num_ctr(void);
 
 int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
@@ -156,6 +210,57 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 
 int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id);
 
+int sbi_pmu_ctr_add_fw_internal(uint64_t event_data, uint64_t value);
+
 void sbi_pmu_ovf_irq();
 
+/** Multiplexed event set of a domain saved in its domain context */
+struct sbi_pmu_mux_context {
+	/* True if the domain has an event set registered */
+	bool registered;
+	/* True if the event set was being rotated */
+	bool running;
+	unsigned long shmem;
+	unsigned long num_events;
+	unsigned long cmask;
+	u64 period;
+	u32 next;
+};
+
+#ifdef CONFIG_SBI_ECALL_PMU_MUX
+
+int sbi_pmu_mux_set_shmem(unsigned long shmem_phys_lo,
+			  unsigned long shmem_phys_hi,
+			  unsigned long num_events, unsigned long cmask,
+			  unsigned long period_us);
+
+int sbi_pmu_mux_start(void);
+
+int sbi_pmu_mux_stop(void);
+
+int sbi_pmu_mux_init(struct sbi_scratch *scratch, bool cold_boot);
+
+void sbi_pmu_mux_exit(struct sbi_scratch *scratch);
+
+/** Stop the event set of the domain being left and save it in @ctx */
+void sbi_pmu_mux_context_save(struct sbi_pmu_mux_context *ctx);
+
+/** Register the event set saved in @ctx and resume its rotation */
+void sbi_pmu_mux_context_restore(const struct sbi_pmu_mux_context *ctx);
+
+#else
+
+static inline int sbi_pmu_mux_init(struct sbi_scratch *scratch,
+				   bool cold_boot) { return 0; }
+
+static inline void sbi_pmu_mux_exit(struct sbi_scratch *scratch) { }
+
+static inline void sbi_pmu_mux_context_save(
+				struct sbi_pmu_mux_context *ctx) { }
+
+static inline void sbi_pmu_mux_context_restore(
+				const struct sbi_pmu_mux_context *ctx) { }
+
+#endif
+
 #endif
@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_SVINVAL_H__
+#define __SBI_SVINVAL_H__
+
+/** Order prior stores before subsequent SINVAL/HINVAL instructions */
+void __sbi_sfence_w_inval(void);
+
+/** Order prior SINVAL/HINVAL instructions before subsequent accesses */
+void __sbi_sfence_inval_ir(void);
+
+/** Invalidate TLB entries for given virtual address */
+void __sbi_sinval_vma_va(unsigned long va);
+
+/** Invalidate TLB entries for given virtual address and ASID */
+void __sbi_sinval_vma_asid_va(unsigned long va, unsigned long asid);
+
+/** Invalidate Stage2 TLBs for given VMID and guest physical address */
+void __sbi_hinval_gvma_vmid_gpa(unsigned long gpa_divby_4,
+				unsigned long vmid);
+
+/** Invalidate Stage2 TLBs for given guest physical address */
+void __sbi_hinval_gvma_gpa(unsigned long gpa_divby_4);
+
+/** Invalidate unified TLB entries for given asid and guest virtual address */
+void __sbi_hinval_vvma_asid_va(unsigned long va, unsigned long asid);
+
+/** Invalidate unified TLB entries for a given guest virtual address */
+void __sbi_hinval_vvma_va(unsigned long va);
+
+#endif
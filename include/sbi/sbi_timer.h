@@ -10,7 +10,8 @@
 #ifndef __SBI_TIMER_H__
 #define __SBI_TIMER_H__
 
-#include <sbi/sbi_list.h>
+#include <sbi/riscv_atomic.h>
+#include <sbi/sbi_minheap.h>
 
 /** Timer event re-start details */
 struct sbi_timer_event_restart {
@@ -22,14 +23,51 @@ struct sbi_timer_event_restart {
 
 /** Timer event abstraction */
 struct sbi_timer_event {
-	/** List head for per-HART event list (Internal) */
-	struct sbi_dlist head;
+	/**
+	 * Node in the per-HART event heap keyed by the latest time
+	 * stamp at which the event must fire (Internal)
+	 */
+	struct sbi_minheap_node node;
+
+	/**
+	 * Timer ticks by which the event may fire late so that it
+	 * can share a timer interrupt with other events. Zero by
+	 * default, must not be changed while the event is started.
+	 */
+	u64 slack;
+
+	/**
+	 * Time stamp for which the event was started, from which on
+	 * it may fire (Internal)
+	 */
+	u64 expiry;
 
-	/** Hart on which the event is started / running (Internal) */
+	/**
+	 * Hart on which the event is started / running, or to which
+	 * it is being moved (Internal)
+	 */
 	int hart_index;
 
-	/** Time stamp when the event expires (Internal) */
-	u64 time_stamp;
+	/** Link in the request inbox of a HART (Internal) */
+	struct sbi_timer_event *inbox_next;
+
+	/** Set while a start / stop request is in flight (Internal) */
+	atomic_t inbox_busy;
+
+	/** HART whose inbox holds the in-flight request (Internal) */
+	int inbox_hart;
+
+	/** Sequence count protecting the latest request (Internal) */
+	volatile unsigned long req_seq;
+
+	/** Sequence count of the last applied request (Internal) */
+	unsigned long req_done;
+
+	/** Time stamp of the latest request (Internal) */
+	volatile u64 req_time;
+
+	/** Target HART of the latest request, -1 to stop (Internal) */
+	volatile int req_hart;
 
 	/**
 	 * Event callback to be called upon expiry.
@@ -38,7 +76,7 @@ struct sbi_timer_event {
 	 * it must update the event re-start details.
 	 *
 	 * NOTE: This will be called with the per-HART timer
-	 * event list lock held.
+	 * event lock held.
 	 */
 	void (*callback)(struct sbi_timer_event *ev,
 			 struct sbi_timer_event_restart *restart);
@@ -47,7 +85,7 @@ struct sbi_timer_event {
 	 * Event cleanup to be called upon sbi_timer_exit()
 	 *
 	 * NOTE: This will be called with per-HART timer
-	 * event list lock held.
+	 * event lock held.
 	 */
 	void (*cleanup)(struct sbi_timer_event *ev);
 
@@ -57,9 +95,17 @@ struct sbi_timer_event {
 
 #define SBI_INIT_TIMER_EVENT(__ptr, __callback, __cleanup, __priv)	\
 do {									\
-	SBI_INIT_LIST_HEAD(&(__ptr)->head);				\
+	SBI_INIT_MINHEAP_NODE(&(__ptr)->node);				\
 	(__ptr)->hart_index = -1;					\
-	(__ptr)->time_stamp = 0;					\
+	(__ptr)->slack = 0;						\
+	(__ptr)->expiry = 0;						\
+	(__ptr)->inbox_next = NULL;					\
+	ATOMIC_INIT(&(__ptr)->inbox_busy, 0);				\
+	(__ptr)->inbox_hart = -1;					\
+	(__ptr)->req_seq = 0;						\
+	(__ptr)->req_done = 0;						\
+	(__ptr)->req_time = 0;						\
+	(__ptr)->req_hart = -1;						\
 	(__ptr)->callback = (__callback); 				\
 	(__ptr)->cleanup = (__cleanup); 				\
 	(__ptr)->priv = (__priv); 					\
@@ -166,10 +212,23 @@ void sbi_timer_set_delta(ulong delta);
 void sbi_timer_set_delta_upper(ulong delta_upper);
 #endif
 
-/** Start timer event on current HART */
+/**
+ * Start timer event on current HART
+ *
+ * If the event is queued on another HART, the request is handed over
+ * to that HART without taking its lock and the event moves to the
+ * current HART once the other HART has processed it.
+ *
+ * Starting and stopping an event must not race with each other or
+ * with the event callback.
+ */
 void sbi_timer_event_start(struct sbi_timer_event *ev, u64 next_event);
 
-/** Stop timer event on current HART */
+/**
+ * Stop timer event
+ *
+ * Returns once the event is no longer queued on any HART.
+ */
 void sbi_timer_event_stop(struct sbi_timer_event *ev);
 
 /** Start supervisor timer event on current HART */
@@ -0,0 +1,55 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Timer internals exposed to the timer unit tests. The tests work on
+ * a timer state of their own which is never programmed into the timer
+ * device, so they don't disturb the events of the HART running them.
+ */
+#ifdef CONFIG_SBIUNIT
+#ifndef __SBI_TIMER_TEST_H__
+#define __SBI_TIMER_TEST_H__
+
+#include <sbi/sbi_types.h>
+
+struct sbi_timer_event;
+struct timer_state;
+
+/** Allocate a timer state owned by the current HART */
+struct timer_state *sbi_timer_test_state_alloc(void);
+
+/** Free a timer state which has no events left */
+void sbi_timer_test_state_free(struct timer_state *tstate);
+
+/** Queue an event on a timer state */
+void sbi_timer_test_event_start(struct timer_state *tstate,
+				struct sbi_timer_event *ev, u64 next_event);
+
+/** Take an event off a timer state */
+void sbi_timer_test_event_stop(struct timer_state *tstate,
+			       struct sbi_timer_event *ev);
+
+/** Write a request for an event and take its inbox as another HART */
+void sbi_timer_test_request(struct sbi_timer_event *ev, u64 time, int target);
+
+/** Push an event onto the inbox of a timer state */
+void sbi_timer_test_push(struct timer_state *tstate,
+			 struct sbi_timer_event *ev);
+
+/** Check whether the inbox of a timer state holds any event */
+bool sbi_timer_test_pending(struct timer_state *tstate);
+
+/** Check whether an event is queued on a timer state */
+bool sbi_timer_test_queued(struct timer_state *tstate,
+			   struct sbi_timer_event *ev);
+
+/** Read the head published by a timer state */
+u64 sbi_timer_test_head(struct timer_state *tstate);
+
+/** Publish the head of a timer state as its owner would */
+void sbi_timer_test_update_head(struct timer_state *tstate);
+
+/** Process the inbox and the expired events of a timer state at @now */
+void sbi_timer_test_process(struct timer_state *tstate, u64 now);
+
+#endif
+#endif
@@ -18,6 +18,9 @@
 
 #define SBI_TLB_FLUSH_ALL			((unsigned long)-1)
 
+/** Maximum number of entries in one sbi_tlb_request_batch() call */
+#define SBI_TLB_BATCH_MAX_ENTRIES		16
+
 /* clang-format on */
 
 struct sbi_scratch;
@@ -54,10 +57,27 @@ do { \
 
 #define SBI_TLB_INFO_SIZE		sizeof(struct sbi_tlb_info)
 
+/** Per-HART statistics of the TLB request transport */
+struct sbi_tlb_stats {
+	/** Number of times a remote queue was found full by this HART */
+	unsigned long queue_full;
+	/** Number of queued requests folded into another one */
+	unsigned long merged;
+	/** Number of coalesced ranges promoted to a full flush */
+	unsigned long promoted;
+};
+
 void __sbi_sfence_vma_all();
 
 int sbi_tlb_request(ulong hmask, ulong hbase, struct sbi_tlb_info *tinfo);
 
+int sbi_tlb_request_batch(ulong hmask, ulong hbase,
+			  struct sbi_tlb_info *tinfo, u32 count);
+
+unsigned long sbi_tlb_range_flush_limit(struct sbi_scratch *scratch);
+
+const struct sbi_tlb_stats *sbi_tlb_get_stats(u32 hartindex);
+
 int sbi_tlb_init(struct sbi_scratch *scratch, bool cold_boot);
 
 #endif
@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __SBI_TRAP_HIST_H__
+#define __SBI_TRAP_HIST_H__
+
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_types.h>
+
+/** Number of log2 latency buckets per histogram */
+#define SBI_TRAP_HIST_BUCKETS		16
+/** Latencies below (1 << SBI_TRAP_HIST_BUCKET_SHIFT) cycles go to bucket 0 */
+#define SBI_TRAP_HIST_BUCKET_SHIFT	4
+
+#ifdef CONFIG_SBI_TRAP_HIST
+
+static inline unsigned long sbi_trap_hist_start(void)
+{
+	return csr_read(CSR_MCYCLE);
+}
+
+/** Account a trap of the given cause which started at @start cycles */
+void sbi_trap_hist_trap(unsigned long mcause, unsigned long start);
+
+/** Account an ecall of the given EID/FID which started at @start cycles */
+void sbi_trap_hist_ecall(unsigned long extid, unsigned long funcid,
+			 unsigned long start);
+
+#else
+
+static inline unsigned long sbi_trap_hist_start(void) { return 0; }
+
+static inline void sbi_trap_hist_trap(unsigned long mcause,
+				      unsigned long start) { }
+
+static inline void sbi_trap_hist_ecall(unsigned long extid,
+				       unsigned long funcid,
+				       unsigned long start) { }
+
+#endif
+
+#endif
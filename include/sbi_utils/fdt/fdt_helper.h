@@ -32,6 +32,7 @@ struct platform_uart_data {
 	unsigned long reg_shift;
 	unsigned long reg_io_width;
 	unsigned long reg_offset;
+	unsigned long fifo_size;
 };
 
 int fdt_parse_phandle_with_args(const void *fdt, int nodeoff,
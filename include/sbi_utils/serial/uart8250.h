@@ -20,17 +20,21 @@ struct uart8250_device {
 	u32 baudrate;
 	u32 reg_width;
 	u32 reg_shift;
+	u32 fifo_size;
 };
 
 int uart8250_device_getc(struct uart8250_device *dev);
 
 void uart8250_device_putc(struct uart8250_device *dev, char ch);
 
+unsigned long uart8250_device_puts(struct uart8250_device *dev,
+				   const char *str, unsigned long len);
+
 void uart8250_device_init(struct uart8250_device *dev, unsigned long base,
 			  u32 in_freq, u32 baudrate, u32 reg_shift,
 			  u32 reg_width, u32 reg_offset, u32 caps);
 
 int uart8250_init(unsigned long base, u32 in_freq, u32 baudrate, u32 reg_shift,
-		  u32 reg_width, u32 reg_offset, u32 caps);
+		  u32 reg_width, u32 reg_offset, u32 caps, u32 fifo_size);
 
 #endif
@@ -64,6 +64,12 @@ libsbi-objs-$(CONFIG_SBI_ECALL_SSE) += sbi_ecall_sse.o
 carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_MPXY) += ecall_mpxy
 libsbi-objs-$(CONFIG_SBI_ECALL_MPXY) += sbi_ecall_mpxy.o
 
+carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_RFENCE_BATCH) += ecall_rfence_batch
+libsbi-objs-$(CONFIG_SBI_ECALL_RFENCE_BATCH) += sbi_ecall_rfence_batch.o
+
+carray-sbi_ecall_exts-$(CONFIG_SBI_ECALL_PMU_MUX) += ecall_pmu_mux
+libsbi-objs-$(CONFIG_SBI_ECALL_PMU_MUX) += sbi_ecall_pmu_mux.o
+
 libsbi-objs-y += sbi_bitmap.o
 libsbi-objs-y += sbi_bitops.o
 libsbi-objs-y += sbi_console.o
@@ -78,8 +84,12 @@ libsbi-objs-y += sbi_hart.o
 libsbi-objs-y += sbi_hart_pmp.o
 libsbi-objs-y += sbi_hart_protection.o
 libsbi-objs-y += sbi_heap.o
+libsbi-objs-$(CONFIG_SBI_HEAP_PROFILE) += sbi_heap_profile.o
 libsbi-objs-y += sbi_math.o
+libsbi-objs-y += sbi_minheap.o
+libsbi-objs-y += sbi_mpsc.o
 libsbi-objs-y += sbi_hfence.o
+libsbi-objs-y += sbi_svinval.o
 libsbi-objs-y += sbi_hsm.o
 libsbi-objs-y += sbi_illegal_atomic.o
 libsbi-objs-y += sbi_illegal_insn.o
@@ -89,6 +99,7 @@ libsbi-objs-y += sbi_irqchip.o
 libsbi-objs-y += sbi_platform.o
 libsbi-objs-y += sbi_pmp.o
 libsbi-objs-y += sbi_pmu.o
+libsbi-objs-$(CONFIG_SBI_ECALL_PMU_MUX) += sbi_pmu_mux.o
 libsbi-objs-y += sbi_dbtr.o
 libsbi-objs-y += sbi_mpxy.o
 libsbi-objs-y += sbi_scratch.o
@@ -98,6 +109,8 @@ libsbi-objs-y += sbi_system.o
 libsbi-objs-y += sbi_timer.o
 libsbi-objs-y += sbi_tlb.o
 libsbi-objs-y += sbi_trap.o
+libsbi-objs-$(CONFIG_SBI_TRAP_HIST) += sbi_trap_hist.o
+libsbi-objs-$(CONFIG_SBI_HOTPC) += sbi_hotpc.o
 libsbi-objs-y += sbi_trap_ldst.o
 libsbi-objs-y += sbi_trap_v_ldst.o
 ifeq ($(UBSAN), y)
@@ -7,10 +7,16 @@
  *   Anup Patel <anup.patel@wdc.com>
  */
 
+#include <sbi/riscv_atomic.h>
+#include <sbi/riscv_barrier.h>
 #include <sbi/riscv_locks.h>
 #include <sbi/sbi_console.h>
+#include <sbi/sbi_error.h>
 #include <sbi/sbi_fifo.h>
 #include <sbi/sbi_hart.h>
+#include <sbi/sbi_hartmask.h>
+#include <sbi/sbi_heap.h>
+#include <sbi/sbi_math.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_scratch.h>
 #include <sbi/sbi_string.h>
@@ -47,7 +53,7 @@ int sbi_getc(void)
 	return -1;
 }
 
-static unsigned long nputs(const char *str, unsigned long len)
+static unsigned long console_dev_nputs(const char *str, unsigned long len)
 {
 	char ch;
 	unsigned long i;
@@ -71,6 +77,250 @@ static unsigned long nputs(const char *str, unsigned long len)
 	return len;
 }
 
+#ifdef CONFIG_SBI_CONSOLE_ASYNC
+
+/*
+ * Per-HART ring of console output. Only the owner HART advances the
+ * head and only the HART holding console_dev_lock advances the tail,
+ * so writing to the ring never waits for the console device.
+ */
+struct console_ring {
+	unsigned long size;
+	unsigned long head;
+	unsigned long tail;
+	char buf[];
+};
+
+static unsigned long console_ring_off;
+static spinlock_t console_dev_lock = SPIN_LOCK_INITIALIZER;
+/* HART index holding console_dev_lock, -1U when it is free */
+static u32 console_dev_owner = -1U;
+/* Bytes in all rings, lets draining skip the rings when they are empty */
+static atomic_t console_pending = ATOMIC_INITIALIZER(0);
+static bool console_sync;
+static u32 console_drain_next;
+
+static bool console_dev_trylock(void)
+{
+	if (!spin_trylock(&console_dev_lock))
+		return false;
+
+	console_dev_owner = current_hartindex();
+	return true;
+}
+
+/*
+ * Returns false without taking console_dev_lock if this HART already
+ * holds it, which happens when a panic or a hang interrupts the HART
+ * while it writes to the console device.
+ */
+static bool console_dev_lock_get(void)
+{
+	u32 hart_index = current_hartindex();
+
+	if (console_dev_owner == hart_index)
+		return false;
+
+	spin_lock(&console_dev_lock);
+	console_dev_owner = hart_index;
+	return true;
+}
+
+static void console_dev_unlock(bool locked)
+{
+	if (!locked)
+		return;
+
+	console_dev_owner = -1U;
+	spin_unlock(&console_dev_lock);
+}
+
+static struct console_ring *console_ring_ptr(struct sbi_scratch *scratch)
+{
+	if (!console_ring_off || !scratch)
+		return NULL;
+
+	return sbi_scratch_read_type(scratch, struct console_ring *,
+				     console_ring_off);
+}
+
+static unsigned long console_ring_write(struct console_ring *r,
+					const char *str, unsigned long len)
+{
+	unsigned long head = r->head, tail = __smp_load_acquire(&r->tail);
+	unsigned long pos, chunk, mask = r->size - 1;
+
+	if (len > r->size - (head - tail))
+		len = r->size - (head - tail);
+
+	pos = head & mask;
+	chunk = (len < r->size - pos) ? len : r->size - pos;
+	sbi_memcpy(&r->buf[pos], str, chunk);
+	sbi_memcpy(r->buf, &str[chunk], len - chunk);
+
+	__smp_store_release(&r->head, head + len);
+	if (len)
+		atomic_add_return(&console_pending, len);
+
+	return len;
+}
+
+/* Must be called with console_dev_lock held */
+static unsigned long console_ring_drain(struct console_ring *r,
+					unsigned long budget)
+{
+	unsigned long head = __smp_load_acquire(&r->head), tail = r->tail;
+	unsigned long pos, chunk, done = 0;
+
+	while (tail != head && done < budget) {
+		pos = tail & (r->size - 1);
+		chunk = head - tail;
+		if (chunk > r->size - pos)
+			chunk = r->size - pos;
+		if (chunk > budget - done)
+			chunk = budget - done;
+
+		chunk = console_dev_nputs(&r->buf[pos], chunk);
+		if (!chunk)
+			break;
+		tail += chunk;
+		done += chunk;
+	}
+
+	__smp_store_release(&r->tail, tail);
+	if (done)
+		atomic_sub_return(&console_pending, done);
+
+	return done;
+}
+
+/* Must be called with console_dev_lock held */
+static unsigned long console_drain(unsigned long budget)
+{
+	unsigned long done = 0;
+	struct console_ring *r;
+	u32 i, count = sbi_hart_count();
+
+	/* Start with a different HART each time so that none starves */
+	for (i = 0; i < count && done < budget; i++) {
+		r = console_ring_ptr(sbi_hartindex_to_scratch(
+					(console_drain_next + i) % count));
+		if (r)
+			done += console_ring_drain(r, budget - done);
+	}
+	console_drain_next = (console_drain_next + 1) % count;
+
+	return done;
+}
+
+void sbi_console_drain(void)
+{
+	unsigned long done, ret;
+
+	/*
+	 * Once the device is ours write out every ring, not just the
+	 * ring of this HART, since the HARTs which failed to take the
+	 * lock meanwhile left their output to us. Look again after
+	 * dropping the lock for output which came in just before.
+	 */
+	do {
+		if (!atomic_read(&console_pending) || !console_dev_trylock())
+			return;
+
+		done = 0;
+		while ((ret = console_drain(CONFIG_SBI_CONSOLE_ASYNC_BATCH)))
+			done += ret;
+
+		console_dev_unlock(true);
+	} while (done);
+}
+
+void sbi_console_flush(void)
+{
+	bool locked;
+
+	if (!console_ring_off)
+		return;
+
+	locked = console_dev_lock_get();
+	while (console_drain(-1UL))
+		;
+	console_dev_unlock(locked);
+}
+
+static unsigned long nputs(const char *str, unsigned long len)
+{
+	struct console_ring *r = NULL;
+	unsigned long ret;
+	bool locked;
+
+	if (console_dev && !console_sync)
+		r = console_ring_ptr(sbi_scratch_thishart_ptr());
+
+	if (!r) {
+		locked = console_dev_lock_get();
+		ret = console_dev_nputs(str, len);
+		console_dev_unlock(locked);
+		return ret;
+	}
+
+	ret = console_ring_write(r, str, len);
+	if (!ret) {
+		/*
+		 * The ring is full so wait for the device to make room
+		 * for one batch instead of writing out all the rings.
+		 */
+		locked = console_dev_lock_get();
+		console_ring_drain(r, CONFIG_SBI_CONSOLE_ASYNC_BATCH);
+		console_dev_unlock(locked);
+		ret = console_ring_write(r, str, len);
+	}
+
+	return ret;
+}
+
+static void console_enter_sync(void)
+{
+	console_sync = true;
+	sbi_console_flush();
+}
+
+int sbi_console_async_init(struct sbi_scratch *scratch, bool cold_boot)
+{
+	unsigned long size = 1UL << log2roundup(CONFIG_SBI_CONSOLE_ASYNC_RING_SIZE);
+	struct console_ring *r;
+
+	if (cold_boot) {
+		console_ring_off = sbi_scratch_alloc_type_offset(struct console_ring *);
+		if (!console_ring_off)
+			return SBI_ENOMEM;
+	}
+
+	/* Keep the ring across warm boots of the HART */
+	if (console_ring_ptr(scratch))
+		return 0;
+
+	r = sbi_zalloc(sizeof(*r) + size);
+	if (!r)
+		return SBI_ENOMEM;
+	r->size = size;
+	sbi_scratch_write_type(scratch, struct console_ring *,
+			       console_ring_off, r);
+
+	return 0;
+}
+
+#else
+
+static unsigned long nputs(const char *str, unsigned long len)
+{
+	return console_dev_nputs(str, len);
+}
+
+static inline void console_enter_sync(void) { }
+
+#endif
+
 static void nputs_all(const char *str, unsigned long len)
 {
 	unsigned long p = 0;
@@ -79,9 +329,20 @@ static void nputs_all(const char *str, unsigned long len)
 		p += nputs(&str[p], len - p);
 }
 
+/*
+ * Buffered output is written out once console_out_lock is released so
+ * that other HARTs don't wait for the console device to print.
+ */
+static void console_out_unlock(void)
+{
+	spin_unlock(&console_out_lock);
+	sbi_console_drain();
+}
+
 void sbi_putc(char ch)
 {
 	nputs_all(&ch, 1);
+	sbi_console_drain();
 }
 
 void sbi_puts(const char *str)
@@ -90,7 +351,7 @@ void sbi_puts(const char *str)
 
 	spin_lock(&console_out_lock);
 	nputs_all(str, len);
-	spin_unlock(&console_out_lock);
+	console_out_unlock();
 }
 
 unsigned long sbi_nputs(const char *str, unsigned long len)
@@ -99,7 +360,7 @@ unsigned long sbi_nputs(const char *str, unsigned long len)
 
 	spin_lock(&console_out_lock);
 	ret = nputs(str, len);
-	spin_unlock(&console_out_lock);
+	console_out_unlock();
 
 	return ret;
 }
@@ -446,7 +707,7 @@ int sbi_printf(const char *format, ...)
 	va_start(args, format);
 	retval = print(NULL, NULL, format, args);
 	va_end(args);
-	spin_unlock(&console_out_lock);
+	console_out_unlock();
 
 	return retval;
 }
@@ -461,7 +722,7 @@ int sbi_dprintf(const char *format, ...)
 	if (scratch->options & SBI_SCRATCH_DEBUG_PRINTS) {
 		spin_lock(&console_out_lock);
 		retval = print(NULL, NULL, format, args);
-		spin_unlock(&console_out_lock);
+		console_out_unlock();
 	}
 	va_end(args);
 
@@ -472,6 +733,8 @@ void sbi_panic(const char *format, ...)
 {
 	va_list args;
 
+	console_enter_sync();
+
 	spin_lock(&console_out_lock);
 	va_start(args, format);
 	print(NULL, NULL, format, args);
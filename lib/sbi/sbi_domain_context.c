@@ -17,6 +17,7 @@
 #include <sbi/sbi_domain.h>
 #include <sbi/sbi_domain_context.h>
 #include <sbi/sbi_platform.h>
+#include <sbi/sbi_pmu.h>
 #include <sbi/sbi_trap.h>
 #include <sbi/sbi_vector.h>
 #include <sbi/sbi_fp.h>
@@ -55,6 +56,8 @@ struct hart_context {
 	struct sbi_fp_context fp_ctx;
 	/** Vector context state */
 	struct sbi_vector_context *vec_ctx;
+	/** PMU counter state */
+	struct sbi_pmu_context *pmu_ctx;
 
 	/** Reference to the owning domain */
 	struct sbi_domain *dom;
@@ -159,6 +162,9 @@ static int switch_to_next_domain_context(struct hart_context *ctx,
 		sbi_vector_restore(dom_ctx->vec_ctx);
 	}
 
+	/* Lazy context switch for PMU counters */
+	sbi_pmu_context_switch(&ctx->pmu_ctx, dom_ctx->pmu_ctx);
+
 	/* Save current trap state and restore target domain's trap state */
 	trap_ctx = sbi_trap_get_context(scratch);
 	sbi_memcpy(&ctx->trap_ctx, trap_ctx, sizeof(*trap_ctx));
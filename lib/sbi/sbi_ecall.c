@@ -7,12 +7,15 @@
  *   Anup Patel <anup.patel@wdc.com>
  */
 
+#include <sbi/riscv_barrier.h>
 #include <sbi/sbi_console.h>
 #include <sbi/sbi_ecall.h>
 #include <sbi/sbi_ecall_interface.h>
 #include <sbi/sbi_error.h>
+#include <sbi/sbi_heap.h>
 #include <sbi/sbi_string.h>
 #include <sbi/sbi_trap.h>
+#include <sbi/sbi_trap_hist.h>
 
 extern struct sbi_ecall_extension *const sbi_ecall_exts[];
 
@@ -40,10 +43,140 @@ void sbi_ecall_set_impid(unsigned long impid)
 
 static SBI_LIST_HEAD(ecall_exts_list);
 
+/* Extension ID range entry of the lookup table */
+struct ecall_table_entry {
+	unsigned long extid_start;
+	unsigned long extid_end;
+	struct sbi_ecall_extension *ext;
+};
+
+/*
+ * Lookup table built from ecall_exts_list once sbi_ecall_init() is done
+ * and rebuilt whenever an extension is registered or unregistered later.
+ * Entries are sorted by extension ID so that any ID, including the vendor
+ * and legacy ranges, is resolved with a binary search. Recently used
+ * entries are remembered in a small direct-mapped cache which makes the
+ * hot extensions (TIME, IPI, RFENCE, PMU, ...) a single probe.
+ *
+ * Other HARTs look up extensions without locking, so the table is
+ * rebuilt in place between two increments of a sequence count and a
+ * lookup which overlaps a rebuild tries again. The table has room for
+ * ECALL_TABLE_SPARE extensions registered after boot, lookups fall back
+ * to the list walk while more are registered.
+ */
+#define ECALL_CACHE_SIZE	16
+#define ECALL_TABLE_SPARE	8
+
+static struct ecall_table_entry *ecall_table_buf;
+static u32 ecall_table_size;
+/* Either ecall_table_buf or NULL while lookups walk the list */
+static struct ecall_table_entry *ecall_table;
+static u32 ecall_table_count;
+static volatile unsigned long ecall_table_seq;
+/* Indexes of recently used entries, checked against the table */
+static u32 ecall_cache[ECALL_CACHE_SIZE];
+/* Set once sbi_ecall_init() is done, later changes rebuild the table */
+static bool ecall_table_ready;
+
+static inline u32 ecall_cache_index(unsigned long extid)
+{
+	/* Standard extension IDs are ASCII codes so fold all the bytes */
+	extid ^= extid >> 16;
+	extid ^= extid >> 8;
+
+	return extid & (ECALL_CACHE_SIZE - 1);
+}
+
+static void ecall_table_build(void)
+{
+	struct ecall_table_entry *entries = ecall_table_buf, tmp;
+	struct sbi_ecall_extension *t;
+	u32 i, count = 0;
+
+	sbi_list_for_each_entry(t, &ecall_exts_list, head)
+		count++;
+
+	ecall_table_seq++;
+	smp_wmb();
+
+	if (count > ecall_table_size) {
+		ecall_table = NULL;
+		goto done;
+	}
+
+	/* Insertion sort, registered ranges never overlap */
+	count = 0;
+	sbi_list_for_each_entry(t, &ecall_exts_list, head) {
+		tmp.extid_start = t->extid_start;
+		tmp.extid_end = t->extid_end;
+		tmp.ext = t;
+		for (i = count; i > 0; i--) {
+			if (entries[i - 1].extid_start < tmp.extid_start)
+				break;
+			entries[i] = entries[i - 1];
+		}
+		entries[i] = tmp;
+		count++;
+	}
+	ecall_table_count = count;
+	ecall_table = entries;
+
+done:
+	smp_wmb();
+	ecall_table_seq++;
+}
+
+static struct sbi_ecall_extension *ecall_table_find(
+				struct ecall_table_entry *entries,
+				unsigned long extid)
+{
+	u32 lo = 0, hi = ecall_table_count, mid;
+	u32 idx = ecall_cache_index(extid);
+	struct ecall_table_entry *e;
+
+	/* A stale index just misses since ranges never overlap */
+	mid = ecall_cache[idx];
+	if (mid < hi) {
+		e = &entries[mid];
+		if (e->extid_start <= extid && extid <= e->extid_end)
+			return e->ext;
+	}
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = &entries[mid];
+		if (extid < e->extid_start)
+			hi = mid;
+		else if (e->extid_end < extid)
+			lo = mid + 1;
+		else {
+			ecall_cache[idx] = mid;
+			return e->ext;
+		}
+	}
+
+	return NULL;
+}
+
 struct sbi_ecall_extension *sbi_ecall_find_extension(unsigned long extid)
 {
 	struct sbi_ecall_extension *t, *ret = NULL;
+	struct ecall_table_entry *entries;
+	unsigned long seq;
+
+	do {
+		seq = ecall_table_seq;
+		smp_rmb();
+		entries = ecall_table;
+		if (!entries)
+			goto walk;
+		ret = ecall_table_find(entries, extid);
+		smp_rmb();
+	} while ((seq & 1) || seq != ecall_table_seq);
 
+	return ret;
+
+walk:
 	sbi_list_for_each_entry(t, &ecall_exts_list, head) {
 		if (t->extid_start <= extid && extid <= t->extid_end) {
 			ret = t;
@@ -95,6 +228,9 @@ int sbi_ecall_register_extension(struct sbi_ecall_extension *ext)
 
 	sbi_list_add_tail(&ext->head, &ecall_exts_list);
 
+	if (ecall_table_ready)
+		ecall_table_build();
+
 	return 0;
 }
 
@@ -113,8 +249,11 @@ void sbi_ecall_unregister_extension(struct sbi_ecall_extension *ext)
 		}
 	}
 
-	if (found)
+	if (found) {
 		sbi_list_del_init(&ext->head);
+		if (ecall_table_ready)
+			ecall_table_build();
+	}
 }
 
 int sbi_ecall_handler(struct sbi_trap_context *tcntx)
@@ -126,6 +265,7 @@ int sbi_ecall_handler(struct sbi_trap_context *tcntx)
 	unsigned long func_id = regs->a6;
 	struct sbi_ecall_return out = {0};
 	bool is_0_1_spec = 0;
+	unsigned long hist_start = sbi_trap_hist_start();
 
 	ext = sbi_ecall_find_extension(extension_id);
 	if (ext && ext->handle) {
@@ -161,9 +301,41 @@ int sbi_ecall_handler(struct sbi_trap_context *tcntx)
 			regs->a1 = out.value;
 	}
 
+	sbi_trap_hist_ecall(extension_id, func_id, hist_start);
+
 	return 0;
 }
 
+#ifdef CONFIG_SBI_ECALL_FAST_PATH
+/*
+ * Called by the trap entry code for the ecalls taking the fast path. Only
+ * the registers clobbered by a C call, SP, MEPC and MSTATUS are saved in
+ * regs and there is no trap context, so the extension handler must only
+ * use a0-a7 of regs.
+ */
+struct sbi_trap_regs *sbi_ecall_fast_handler(struct sbi_trap_regs *regs)
+{
+	int ret;
+	struct sbi_ecall_extension *ext;
+	struct sbi_ecall_return out = {0};
+	unsigned long hist_start = sbi_trap_hist_start();
+
+	ext = sbi_ecall_find_extension(regs->a7);
+	if (ext && ext->handle)
+		ret = ext->handle(regs->a7, regs->a6, regs, &out);
+	else
+		ret = SBI_ENOTSUPP;
+
+	regs->mepc += 4;
+	regs->a0 = ret;
+	regs->a1 = out.value;
+
+	sbi_trap_hist_ecall(regs->a7, regs->a6, hist_start);
+
+	return regs;
+}
+#endif
+
 int sbi_ecall_init(void)
 {
 	int ret;
@@ -180,5 +352,16 @@ int sbi_ecall_init(void)
 			return ret;
 	}
 
+	/* Without a table lookups fall back to the list walk */
+	sbi_list_for_each_entry(ext, &ecall_exts_list, head)
+		ecall_table_size++;
+	ecall_table_size += ECALL_TABLE_SPARE;
+	ecall_table_buf = sbi_calloc(ecall_table_size, sizeof(*ecall_table_buf));
+	if (!ecall_table_buf)
+		ecall_table_size = 0;
+
+	ecall_table_ready = true;
+	ecall_table_build();
+
 	return 0;
 }
@@ -15,6 +15,85 @@
 #include <sbi/sbi_trap.h>
 #include <sbi/riscv_asm.h>
 #include <sbi/sbi_hart_protection.h>
+#include <sbi/sbi_scratch.h>
+
+/*
+ * Last console buffer validated on a HART. Guests usually log through
+ * one buffer, so repeated writes skip the domain memory region walk.
+ */
+struct dbcn_range_cache {
+	const struct sbi_domain *dom;
+	unsigned long mode;
+	unsigned long start;
+	unsigned long end;
+	/* M-mode can access the range without a dynamic mapping */
+	bool shared;
+};
+
+static unsigned long dbcn_cache_offset;
+
+/*
+ * Check whether [addr, end) is covered by a single memory region of
+ * the domain which is shared read/write between M-mode and SU-mode.
+ * Such a region is always programmed in the PMP, so M-mode can access
+ * the buffer directly without reprogramming the reserved entry.
+ */
+static bool dbcn_range_is_shared(const struct sbi_domain *dom,
+				 unsigned long addr, unsigned long end)
+{
+	struct sbi_domain_memregion *reg;
+	unsigned long rstart, rend;
+
+	sbi_domain_for_each_memregion(dom, reg) {
+		rstart = reg->base;
+		rend = (reg->order < __riscv_xlen) ?
+			rstart + ((1UL << reg->order) - 1) : -1UL;
+		if (rend < addr || end - 1 < rstart)
+			continue;
+
+		/* First overlapping region has the highest priority */
+		return rstart <= addr && end - 1 <= rend &&
+		       SBI_DOMAIN_MEMREGION_IS_SURW_MRW(reg->flags);
+	}
+
+	return false;
+}
+
+static int dbcn_check_range(unsigned long addr, unsigned long size,
+			    unsigned long mode, bool *shared)
+{
+	const struct sbi_domain *dom = sbi_domain_thishart_ptr();
+	struct dbcn_range_cache *cache = NULL;
+	unsigned long end = addr + size;
+
+	if (end < addr)
+		return SBI_ERR_INVALID_PARAM;
+
+	if (dbcn_cache_offset) {
+		cache = sbi_scratch_thishart_offset_ptr(dbcn_cache_offset);
+		if (cache->dom == dom && cache->mode == mode &&
+		    cache->start <= addr && end <= cache->end) {
+			*shared = cache->shared;
+			return 0;
+		}
+	}
+
+	if (!sbi_domain_check_addr_range(dom, addr, size, mode,
+					 SBI_DOMAIN_READ|SBI_DOMAIN_WRITE))
+		return SBI_ERR_INVALID_PARAM;
+
+	*shared = size && dbcn_range_is_shared(dom, addr, end);
+
+	if (cache) {
+		cache->dom = dom;
+		cache->mode = mode;
+		cache->start = addr;
+		cache->end = end;
+		cache->shared = *shared;
+	}
+
+	return 0;
+}
 
 static int sbi_ecall_dbcn_handler(unsigned long extid, unsigned long funcid,
 				  struct sbi_trap_regs *regs,
@@ -22,6 +101,8 @@ static int sbi_ecall_dbcn_handler(unsigned long extid, unsigned long funcid,
 {
 	ulong smode = (csr_read(CSR_MSTATUS) & MSTATUS_MPP) >>
 			MSTATUS_MPP_SHIFT;
+	bool shared;
+	int ret;
 
 	switch (funcid) {
 	case SBI_EXT_DBCN_CONSOLE_WRITE:
@@ -42,16 +123,23 @@ static int sbi_ecall_dbcn_handler(unsigned long extid, unsigned long funcid,
 		if (regs->a2)
 			return SBI_ERR_FAILED;
 
-		if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
-					regs->a1, regs->a0, smode,
-					SBI_DOMAIN_READ|SBI_DOMAIN_WRITE))
-			return SBI_ERR_INVALID_PARAM;
-		sbi_hart_protection_map_range(regs->a1, regs->a0);
+		ret = dbcn_check_range(regs->a1, regs->a0, smode, &shared);
+		if (ret)
+			return ret;
+
+		/*
+		 * Buffers placed in a region which the domain shares with
+		 * M-mode need no dynamic mapping, so chatty guests do not
+		 * pay for a PMP reprogramming and fence on every write.
+		 */
+		if (!shared)
+			sbi_hart_protection_map_range(regs->a1, regs->a0);
 		if (funcid == SBI_EXT_DBCN_CONSOLE_WRITE)
 			out->value = sbi_nputs((const char *)regs->a1, regs->a0);
 		else
 			out->value = sbi_ngets((char *)regs->a1, regs->a0);
-		sbi_hart_protection_unmap_range(regs->a1, regs->a0);
+		if (!shared)
+			sbi_hart_protection_unmap_range(regs->a1, regs->a0);
 		return 0;
 	case SBI_EXT_DBCN_CONSOLE_WRITE_BYTE:
 		sbi_putc(regs->a0);
@@ -70,6 +158,11 @@ static int sbi_ecall_dbcn_register_extensions(void)
 	if (!sbi_console_get_device())
 		return 0;
 
+	/* The cache is optional, DBCN works without it */
+	if (!dbcn_cache_offset)
+		dbcn_cache_offset =
+			sbi_scratch_alloc_type_offset(struct dbcn_range_cache);
+
 	return sbi_ecall_register_extension(&ecall_dbcn);
 }
 
@@ -77,7 +77,8 @@ static int sbi_ecall_pmu_handler(unsigned long extid, unsigned long funcid,
 		ret = sbi_pmu_event_get_info(regs->a0, regs->a1, regs->a2, regs->a3);
 		break;
 	case SBI_EXT_PMU_SNAPSHOT_SET_SHMEM:
-		/* fallthrough as OpenSBI doesn't support snapshot yet */
+		ret = sbi_pmu_snapshot_set_shmem(regs->a0, regs->a1, regs->a2);
+		break;
 	default:
 		ret = SBI_ENOTSUPP;
 	}
@@ -0,0 +1,47 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/sbi_ecall.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_pmu.h>
+#include <sbi/sbi_trap.h>
+
+static int sbi_ecall_pmu_mux_handler(unsigned long extid,
+				     unsigned long funcid,
+				     struct sbi_trap_regs *regs,
+				     struct sbi_ecall_return *out)
+{
+	switch (funcid) {
+	case SBI_EXT_PMU_MUX_SET_SHMEM:
+		/*
+		 * a0/a1 = lower/upper physical address of the event set,
+		 * a2 = number of events, a3 = hardware counters to rotate
+		 * the events over and a4 = rotation period in microseconds.
+		 */
+		return sbi_pmu_mux_set_shmem(regs->a0, regs->a1, regs->a2,
+					     regs->a3, regs->a4);
+	case SBI_EXT_PMU_MUX_START:
+		return sbi_pmu_mux_start();
+	case SBI_EXT_PMU_MUX_STOP:
+		return sbi_pmu_mux_stop();
+	default:
+		return SBI_ENOTSUPP;
+	}
+}
+
+struct sbi_ecall_extension ecall_pmu_mux;
+
+static int sbi_ecall_pmu_mux_register_extensions(void)
+{
+	return sbi_ecall_register_extension(&ecall_pmu_mux);
+}
+
+struct sbi_ecall_extension ecall_pmu_mux = {
+	.name			= "pmumux",
+	.extid_start		= SBI_EXT_PMU_MUX,
+	.extid_end		= SBI_EXT_PMU_MUX,
+	.register_extensions	= sbi_ecall_pmu_mux_register_extensions,
+	.handle			= sbi_ecall_pmu_mux_handler,
+};
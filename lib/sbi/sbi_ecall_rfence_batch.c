@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_ecall.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_hart_protection.h>
+#include <sbi/sbi_trap.h>
+#include <sbi/sbi_tlb.h>
+
+static int rfence_batch_entry_to_tlb_info(struct sbi_rfence_batch_entry *entry,
+					  struct sbi_tlb_info *tinfo,
+					  u32 source_hart)
+{
+	unsigned long vmid;
+
+	if (entry->fid >= SBI_EXT_RFENCE_REMOTE_HFENCE_GVMA_VMID &&
+	    entry->fid <= SBI_EXT_RFENCE_REMOTE_HFENCE_VVMA)
+		if (!misa_extension('H'))
+			return SBI_ENOTSUPP;
+
+	switch (entry->fid) {
+	case SBI_EXT_RFENCE_REMOTE_FENCE_I:
+		SBI_TLB_INFO_INIT(tinfo, 0, 0, 0, 0,
+				  SBI_TLB_FENCE_I, source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_HFENCE_GVMA:
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, 0, 0,
+				  SBI_TLB_HFENCE_GVMA, source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_HFENCE_GVMA_VMID:
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, 0,
+				  entry->id, SBI_TLB_HFENCE_GVMA_VMID,
+				  source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_HFENCE_VVMA:
+		vmid = (csr_read(CSR_HGATP) & HGATP_VMID_MASK);
+		vmid = vmid >> HGATP_VMID_SHIFT;
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, 0, vmid,
+				  SBI_TLB_HFENCE_VVMA, source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_HFENCE_VVMA_ASID:
+		vmid = (csr_read(CSR_HGATP) & HGATP_VMID_MASK);
+		vmid = vmid >> HGATP_VMID_SHIFT;
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, entry->id,
+				  vmid, SBI_TLB_HFENCE_VVMA_ASID, source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_SFENCE_VMA:
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, 0, 0,
+				  SBI_TLB_SFENCE_VMA, source_hart);
+		break;
+	case SBI_EXT_RFENCE_REMOTE_SFENCE_VMA_ASID:
+		SBI_TLB_INFO_INIT(tinfo, entry->start, entry->size, entry->id,
+				  0, SBI_TLB_SFENCE_VMA_ASID, source_hart);
+		break;
+	default:
+		return SBI_EINVAL;
+	}
+
+	return 0;
+}
+
+static int sbi_ecall_rfence_batch_handler(unsigned long extid,
+					  unsigned long funcid,
+					  struct sbi_trap_regs *regs,
+					  struct sbi_ecall_return *out)
+{
+	int ret = 0;
+	unsigned long i, count, size;
+	struct sbi_rfence_batch_entry *entries;
+	struct sbi_tlb_info tinfo[SBI_TLB_BATCH_MAX_ENTRIES];
+	u32 source_hart = current_hartid();
+	ulong smode = (csr_read(CSR_MSTATUS) & MSTATUS_MPP) >>
+			MSTATUS_MPP_SHIFT;
+
+	if (funcid != SBI_EXT_RFENCE_BATCH_REMOTE_FENCE)
+		return SBI_ENOTSUPP;
+
+	/*
+	 * a0 = hart mask, a1 = hart mask base, a2/a3 = lower/upper
+	 * physical address of the entry list and a4 = entry count.
+	 * As for DBCN, M-mode can only access the lower part of the
+	 * physical address space so the upper bits must be zero.
+	 */
+	count = regs->a4;
+	if (!count)
+		return 0;
+	if (count > SBI_TLB_BATCH_MAX_ENTRIES)
+		return SBI_EINVAL;
+	if (regs->a3 || (regs->a2 & (sizeof(unsigned long) - 1)))
+		return SBI_EINVALID_ADDR;
+
+	size = count * sizeof(*entries);
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
+					 regs->a2, size, smode,
+					 SBI_DOMAIN_READ))
+		return SBI_EINVALID_ADDR;
+
+	entries = (struct sbi_rfence_batch_entry *)regs->a2;
+	sbi_hart_protection_map_range(regs->a2, size);
+	for (i = 0; i < count; i++) {
+		ret = rfence_batch_entry_to_tlb_info(&entries[i], &tinfo[i],
+						     source_hart);
+		if (ret)
+			break;
+	}
+	sbi_hart_protection_unmap_range(regs->a2, size);
+	if (ret)
+		return ret;
+
+	return sbi_tlb_request_batch(regs->a0, regs->a1, tinfo, count);
+}
+
+struct sbi_ecall_extension ecall_rfence_batch;
+
+static int sbi_ecall_rfence_batch_register_extensions(void)
+{
+	return sbi_ecall_register_extension(&ecall_rfence_batch);
+}
+
+struct sbi_ecall_extension ecall_rfence_batch = {
+	.name			= "rfncbat",
+	.extid_start		= SBI_EXT_RFENCE_BATCH,
+	.extid_end		= SBI_EXT_RFENCE_BATCH,
+	.register_extensions	= sbi_ecall_rfence_batch_register_extensions,
+	.handle			= sbi_ecall_rfence_batch_handler,
+};
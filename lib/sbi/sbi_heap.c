@@ -8,7 +8,9 @@
  */
 
 #include <sbi/riscv_locks.h>
+#include <sbi/sbi_bitmap.h>
 #include <sbi/sbi_error.h>
+#include <sbi/sbi_hartmask.h>
 #include <sbi/sbi_heap.h>
 #include <sbi/sbi_list.h>
 #include <sbi/sbi_scratch.h>
@@ -20,126 +22,726 @@
 /* Number of heap nodes to allocate at once */
 #define HEAP_NODE_BATCH_SIZE		8
 
+/* Size and alignment of a slab used to carve out small objects */
+#define HEAP_SLAB_SHIFT			11
+#define HEAP_SLAB_SIZE			(1UL << HEAP_SLAB_SHIFT)
+
+/* Slab size classes are 64, 128 and 256 bytes */
+#define HEAP_SLAB_CLASS_COUNT		3
+#define HEAP_SLAB_OBJ_MAX		(HEAP_ALLOC_ALIGN << (HEAP_SLAB_CLASS_COUNT - 1))
+
+/*
+ * Heap nodes describe free or used blocks and are kept in two AVL trees
+ * ordered by address. Each node also tracks the largest block size in its
+ * subtree so that a fitting free block is found without visiting every
+ * free block.
+ */
 struct heap_node {
-	struct sbi_dlist head;
+	struct heap_node *left;
+	struct heap_node *right;
+	struct heap_node *parent;
 	unsigned long addr;
 	unsigned long size;
+	unsigned long max_size;
+	int height;
+};
+
+/*
+ * Header of a slab, stored in the first object slot of the slab so that
+ * all objects remain naturally aligned to the object size.
+ */
+struct heap_slab {
+	struct sbi_dlist head;
+	void *free;
+	unsigned int inuse;
+	unsigned int class;
+};
+
+struct heap_slab_class {
+	/* Slabs with at least one free object */
+	struct sbi_dlist partial_list;
+	/* Number of slabs on the partial list without any used object */
+	unsigned long empty_count;
 };
 
+/* Number of objects each HART caches per slab size class */
+#define HEAP_CACHE_OBJS			8
+
+struct heap_cache_class {
+	unsigned long count;
+	void *objs[HEAP_CACHE_OBJS];
+};
+
+/* Per-HART cache of slab objects of the global heap */
+struct heap_cache {
+	struct heap_cache_class class[HEAP_SLAB_CLASS_COUNT];
+	struct sbi_heap_cache_stats stats;
+};
+
+static unsigned long heap_cache_offset;
+
 struct sbi_heap_control {
 	spinlock_t lock;
 	unsigned long base;
 	unsigned long size;
 	unsigned long resv;
-	struct sbi_dlist free_node_list;
-	struct sbi_dlist free_space_list;
-	struct sbi_dlist used_space_list;
+	struct heap_node *free_nodes;
+	unsigned long free_node_count;
+	struct heap_node *free_space_root;
+	struct heap_node *used_space_root;
 	struct heap_node init_free_space_node;
+	/* Bytes held by free objects of all slabs */
+	unsigned long slab_free;
+	/* One bit per HEAP_SLAB_SIZE block of the heap, set for slabs */
+	unsigned long *slab_map;
+	unsigned long slab_map_base;
+	unsigned long slab_map_bits;
+	struct heap_slab_class slab_class[HEAP_SLAB_CLASS_COUNT];
 };
 
 struct sbi_heap_control global_hpctrl;
 
-static bool alloc_nodes(struct sbi_heap_control *hpctrl)
+static inline int node_height(struct heap_node *n)
 {
-	size_t size = HEAP_NODE_BATCH_SIZE * sizeof(struct heap_node);
-	struct heap_node *n, *new = NULL;
+	return n ? n->height : 0;
+}
 
-	/* alloc_with_align() requires at most two free nodes */
-	if (hpctrl->free_node_list.next != hpctrl->free_node_list.prev)
-		return true;
+static inline unsigned long node_max_size(struct heap_node *n)
+{
+	return n ? n->max_size : 0;
+}
 
-	sbi_list_for_each_entry_reverse(n, &hpctrl->free_space_list, head) {
-		if (n->size >= size) {
-			n->size -= size;
-			if (!n->size) {
-				sbi_list_del(&n->head);
-				sbi_list_add_tail(&n->head, &hpctrl->free_node_list);
-			}
-			new = (void *)(n->addr + n->size);
-			break;
+static void node_update(struct heap_node *n)
+{
+	int hl = node_height(n->left), hr = node_height(n->right);
+	unsigned long ml = node_max_size(n->left);
+	unsigned long mr = node_max_size(n->right);
+
+	n->height = 1 + ((hl > hr) ? hl : hr);
+	n->max_size = n->size;
+	if (n->max_size < ml)
+		n->max_size = ml;
+	if (n->max_size < mr)
+		n->max_size = mr;
+}
+
+static void tree_replace_child(struct heap_node **root,
+			       struct heap_node *parent,
+			       struct heap_node *old, struct heap_node *new)
+{
+	if (!parent)
+		*root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new)
+		new->parent = parent;
+}
+
+static struct heap_node *tree_rotate_left(struct heap_node **root,
+					  struct heap_node *x)
+{
+	struct heap_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left)
+		y->left->parent = x;
+	tree_replace_child(root, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+	node_update(x);
+	node_update(y);
+
+	return y;
+}
+
+static struct heap_node *tree_rotate_right(struct heap_node **root,
+					   struct heap_node *x)
+{
+	struct heap_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right)
+		y->right->parent = x;
+	tree_replace_child(root, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+	node_update(x);
+	node_update(y);
+
+	return y;
+}
+
+/*
+ * Restore the AVL balance and the subtree maximum sizes on the path
+ * from the given node up to the root.
+ */
+static void tree_fixup(struct heap_node **root, struct heap_node *n)
+{
+	int balance;
+
+	while (n) {
+		node_update(n);
+		balance = node_height(n->left) - node_height(n->right);
+		if (balance > 1) {
+			if (node_height(n->left->left) <
+			    node_height(n->left->right))
+				tree_rotate_left(root, n->left);
+			n = tree_rotate_right(root, n);
+		} else if (balance < -1) {
+			if (node_height(n->right->right) <
+			    node_height(n->right->left))
+				tree_rotate_right(root, n->right);
+			n = tree_rotate_left(root, n);
+		}
+		n = n->parent;
+	}
+}
+
+static void tree_insert(struct heap_node **root, struct heap_node *n)
+{
+	struct heap_node *p = NULL, **link = root;
+
+	while (*link) {
+		p = *link;
+		link = (n->addr < p->addr) ? &p->left : &p->right;
+	}
+
+	n->left = n->right = NULL;
+	n->parent = p;
+	*link = n;
+	tree_fixup(root, n);
+}
+
+static void tree_remove(struct heap_node **root, struct heap_node *n)
+{
+	struct heap_node *s, *fix;
+
+	if (!n->left || !n->right) {
+		fix = n->parent;
+		tree_replace_child(root, n->parent, n,
+				   n->left ? n->left : n->right);
+	} else {
+		/* Replace the node by its in-order successor */
+		s = n->right;
+		while (s->left)
+			s = s->left;
+		if (s->parent != n) {
+			fix = s->parent;
+			tree_replace_child(root, s->parent, s, s->right);
+			s->right = n->right;
+			s->right->parent = s;
+		} else {
+			fix = s;
+		}
+		tree_replace_child(root, n->parent, n, s);
+		s->left = n->left;
+		s->left->parent = s;
+	}
+
+	tree_fixup(root, fix);
+}
+
+/* Find the node with the highest address less than or equal to addr */
+static struct heap_node *tree_floor(struct heap_node *n, unsigned long addr)
+{
+	struct heap_node *ret = NULL;
+
+	while (n) {
+		if (n->addr <= addr) {
+			ret = n;
+			n = n->right;
+		} else {
+			n = n->left;
+		}
+	}
+
+	return ret;
+}
+
+/* Find the node with the lowest address greater than addr */
+static struct heap_node *tree_above(struct heap_node *n, unsigned long addr)
+{
+	struct heap_node *ret = NULL;
+
+	while (n) {
+		if (addr < n->addr) {
+			ret = n;
+			n = n->left;
+		} else {
+			n = n->right;
 		}
 	}
-	if (!new)
+
+	return ret;
+}
+
+/* Lowest free block which can hold size bytes at an aligned address */
+static struct heap_node *tree_first_fit(struct heap_node *n,
+					unsigned long align, unsigned long size)
+{
+	struct heap_node *ret;
+
+	if (node_max_size(n) < size)
+		return NULL;
+
+	ret = tree_first_fit(n->left, align, size);
+	if (ret)
+		return ret;
+	if (ROUNDUP(n->addr, align) - n->addr + size <= n->size)
+		return n;
+
+	return tree_first_fit(n->right, align, size);
+}
+
+/* Highest free block which can hold size bytes at an aligned address */
+static struct heap_node *tree_last_fit(struct heap_node *n,
+				       unsigned long align, unsigned long size)
+{
+	struct heap_node *ret;
+
+	if (node_max_size(n) < size)
+		return NULL;
+
+	ret = tree_last_fit(n->right, align, size);
+	if (ret)
+		return ret;
+	if (n->size >= size &&
+	    ROUNDDOWN(n->addr + n->size - size, align) >= n->addr)
+		return n;
+
+	return tree_last_fit(n->left, align, size);
+}
+
+static unsigned long tree_sum_size(struct heap_node *n)
+{
+	if (!n)
+		return 0;
+
+	return n->size + tree_sum_size(n->left) + tree_sum_size(n->right);
+}
+
+static struct heap_node *get_node(struct sbi_heap_control *hpctrl)
+{
+	struct heap_node *n = hpctrl->free_nodes;
+
+	hpctrl->free_nodes = n->right;
+	hpctrl->free_node_count--;
+
+	return n;
+}
+
+static void put_node(struct sbi_heap_control *hpctrl, struct heap_node *n)
+{
+	n->right = hpctrl->free_nodes;
+	hpctrl->free_nodes = n;
+	hpctrl->free_node_count++;
+}
+
+static bool alloc_nodes(struct sbi_heap_control *hpctrl)
+{
+	size_t size = ROUNDUP(HEAP_NODE_BATCH_SIZE * sizeof(struct heap_node),
+			      HEAP_ALLOC_ALIGN);
+	struct heap_node *n, *new;
+
+	/* heap_alloc_locked() requires at most two free nodes */
+	if (hpctrl->free_node_count >= 2)
+		return true;
+
+	/*
+	 * Take the nodes from the bottom of the heap, like regular
+	 * allocations, so that the top stays free for aligned buffers.
+	 */
+	n = tree_first_fit(hpctrl->free_space_root, HEAP_ALLOC_ALIGN, size);
+	if (!n)
 		return false;
 
-	for (size_t i = 0; i < HEAP_NODE_BATCH_SIZE; i++)
-		sbi_list_add_tail(&new[i].head, &hpctrl->free_node_list);
+	new = (void *)n->addr;
+	n->addr += size;
+	n->size -= size;
+	if (!n->size) {
+		tree_remove(&hpctrl->free_space_root, n);
+		put_node(hpctrl, n);
+	} else {
+		tree_fixup(&hpctrl->free_space_root, n);
+	}
+
+	for (size_t i = 0; i < size / sizeof(struct heap_node); i++)
+		put_node(hpctrl, &new[i]);
 	hpctrl->resv += size;
 
 	return true;
 }
 
-static void *alloc_with_align(struct sbi_heap_control *hpctrl,
-			      size_t align, size_t size)
+/*
+ * If @pad is not NULL, it returns the size of the free space left
+ * above a last-fit allocation, which is too small for another buffer
+ * with the same alignment.
+ */
+static void *heap_alloc_locked(struct sbi_heap_control *hpctrl,
+			       size_t align, size_t size, unsigned long *pad)
 {
-	void *ret = NULL;
 	struct heap_node *n, *np;
-	unsigned long lowest_aligned;
-	size_t pad;
-
-	if (!size)
-		return NULL;
+	unsigned long start, end;
 
 	size += align - 1;
 	size &= ~((unsigned long)align - 1);
 
-	spin_lock(&hpctrl->lock);
-
 	/* Ensure at least two free nodes are available for use below */
 	if (!alloc_nodes(hpctrl))
-		goto out;
+		return NULL;
+
+	/*
+	 * Plain allocations are placed first-fit from the bottom of the
+	 * heap. Buffers with a larger alignment are placed last-fit from
+	 * the top instead, where block ends are usually aligned already,
+	 * so they don't leave small pads between the plain allocations.
+	 */
+	if (align <= HEAP_ALLOC_ALIGN) {
+		np = tree_first_fit(hpctrl->free_space_root, align, size);
+		if (!np)
+			return NULL;
+		start = np->addr;
+	} else {
+		np = tree_last_fit(hpctrl->free_space_root, align, size);
+		if (!np)
+			return NULL;
+		start = ROUNDDOWN(np->addr + np->size - size, align);
+	}
+	end = np->addr + np->size;
+	if (pad)
+		*pad = (align <= HEAP_ALLOC_ALIGN) ? 0 : end - (start + size);
+
+	/* Free space above the allocation */
+	if (start + size < end) {
+		n = get_node(hpctrl);
+		n->addr = start + size;
+		n->size = end - n->addr;
+		tree_insert(&hpctrl->free_space_root, n);
+	}
 
-	np = NULL;
-	sbi_list_for_each_entry(n, &hpctrl->free_space_list, head) {
-		lowest_aligned = ROUNDUP(n->addr, align);
-		pad = lowest_aligned - n->addr;
+	/* Free space below the allocation keeps the original node */
+	if (np->addr < start) {
+		np->size = start - np->addr;
+		tree_fixup(&hpctrl->free_space_root, np);
+		np = get_node(hpctrl);
+	} else {
+		tree_remove(&hpctrl->free_space_root, np);
+	}
 
-		if (size + pad <= n->size) {
-			np = n;
-			break;
+	np->addr = start;
+	np->size = size;
+	tree_insert(&hpctrl->used_space_root, np);
+
+	return (void *)np->addr;
+}
+
+static void heap_free_locked(struct sbi_heap_control *hpctrl, void *ptr)
+{
+	struct heap_node *np, *prev, *next;
+
+	np = tree_floor(hpctrl->used_space_root, (unsigned long)ptr);
+	if (!np || (np->addr + np->size) <= (unsigned long)ptr)
+		return;
+
+	tree_remove(&hpctrl->used_space_root, np);
+
+	/* Merge with the free neighbours on both sides */
+	prev = tree_floor(hpctrl->free_space_root, np->addr);
+	next = tree_above(hpctrl->free_space_root, np->addr);
+	if (prev && (prev->addr + prev->size) == np->addr) {
+		prev->size += np->size;
+		put_node(hpctrl, np);
+		np = prev;
+		if (next && (np->addr + np->size) == next->addr) {
+			np->size += next->size;
+			tree_remove(&hpctrl->free_space_root, next);
+			put_node(hpctrl, next);
 		}
+		tree_fixup(&hpctrl->free_space_root, np);
+	} else if (next && (np->addr + np->size) == next->addr) {
+		/* Moving the start of next down keeps the tree ordered */
+		next->addr = np->addr;
+		next->size += np->size;
+		put_node(hpctrl, np);
+		tree_fixup(&hpctrl->free_space_root, next);
+	} else {
+		tree_insert(&hpctrl->free_space_root, np);
 	}
-	if (!np)
-		goto out;
+}
+
+static inline unsigned long slab_obj_size(unsigned int class)
+{
+	return HEAP_ALLOC_ALIGN << class;
+}
+
+static inline unsigned long slab_obj_count(unsigned int class)
+{
+	/* The first object slot holds the slab header */
+	return (HEAP_SLAB_SIZE / slab_obj_size(class)) - 1;
+}
+
+static struct heap_slab *slab_lookup(struct sbi_heap_control *hpctrl,
+				     unsigned long addr)
+{
+	unsigned long bit;
+
+	if (!hpctrl->slab_map || addr < hpctrl->slab_map_base)
+		return NULL;
+
+	bit = (addr - hpctrl->slab_map_base) >> HEAP_SLAB_SHIFT;
+	if (bit >= hpctrl->slab_map_bits ||
+	    !bitmap_test(hpctrl->slab_map, bit))
+		return NULL;
+
+	return (struct heap_slab *)(addr & ~(HEAP_SLAB_SIZE - 1));
+}
+
+static struct heap_slab *slab_create(struct sbi_heap_control *hpctrl,
+				     unsigned int class)
+{
+	unsigned long i, obj_size = slab_obj_size(class);
+	struct heap_slab *slab;
+	void **obj;
+
+	slab = heap_alloc_locked(hpctrl, HEAP_SLAB_SIZE, HEAP_SLAB_SIZE, NULL);
+	if (!slab)
+		return NULL;
+
+	slab->inuse = 0;
+	slab->class = class;
+	slab->free = NULL;
+	for (i = slab_obj_count(class); i > 0; i--) {
+		obj = (void **)((unsigned long)slab + i * obj_size);
+		*obj = slab->free;
+		slab->free = obj;
+	}
+
+	__set_bit((((unsigned long)slab - hpctrl->slab_map_base) >>
+		   HEAP_SLAB_SHIFT), hpctrl->slab_map);
+	sbi_list_add(&slab->head, &hpctrl->slab_class[class].partial_list);
+	hpctrl->slab_class[class].empty_count++;
+	hpctrl->slab_free += slab_obj_count(class) * obj_size;
+	hpctrl->resv += obj_size;
+
+	return slab;
+}
+
+static void slab_destroy(struct sbi_heap_control *hpctrl,
+			 struct heap_slab *slab)
+{
+	unsigned long obj_size = slab_obj_size(slab->class);
+
+	sbi_list_del(&slab->head);
+	hpctrl->slab_class[slab->class].empty_count--;
+	hpctrl->slab_free -= slab_obj_count(slab->class) * obj_size;
+	hpctrl->resv -= obj_size;
+	__clear_bit((((unsigned long)slab - hpctrl->slab_map_base) >>
+		     HEAP_SLAB_SHIFT), hpctrl->slab_map);
+
+	heap_free_locked(hpctrl, slab);
+}
+
+static int slab_class(struct sbi_heap_control *hpctrl,
+		      size_t align, size_t size)
+{
+	unsigned int class;
 
-	if (pad) {
-		n = sbi_list_first_entry(&hpctrl->free_node_list,
-					 struct heap_node, head);
-		sbi_list_del(&n->head);
+	if (!hpctrl->slab_map || HEAP_SLAB_OBJ_MAX < size ||
+	    HEAP_SLAB_OBJ_MAX < align)
+		return -1;
 
-		n->addr = np->addr;
-		n->size = pad;
-		sbi_list_add_tail(&n->head, &np->head);
+	/* Objects are naturally aligned so any alignment up to the size works */
+	if (size < align)
+		size = align;
+	class = 0;
+	while (slab_obj_size(class) < size)
+		class++;
 
-		np->addr += pad;
-		np->size -= pad;
+	return class;
+}
+
+static void *slab_alloc(struct sbi_heap_control *hpctrl, unsigned int class)
+{
+	struct heap_slab_class *sc = &hpctrl->slab_class[class];
+	struct heap_slab *slab;
+	void **obj;
+
+	if (sbi_list_empty(&sc->partial_list)) {
+		if (!slab_create(hpctrl, class))
+			return NULL;
 	}
 
-	if (size < np->size) {
-		n = sbi_list_first_entry(&hpctrl->free_node_list,
-					 struct heap_node, head);
-		sbi_list_del(&n->head);
+	slab = sbi_list_first_entry(&sc->partial_list, struct heap_slab, head);
+	if (!slab->inuse)
+		sc->empty_count--;
+
+	obj = slab->free;
+	slab->free = *obj;
+	slab->inuse++;
+	if (!slab->free)
+		sbi_list_del_init(&slab->head);
+	hpctrl->slab_free -= slab_obj_size(class);
+
+	return obj;
+}
+
+static bool slab_free(struct sbi_heap_control *hpctrl, void *ptr)
+{
+	struct heap_slab *slab = slab_lookup(hpctrl, (unsigned long)ptr);
+	struct heap_slab_class *sc;
+	unsigned long obj_size;
+	void **obj = ptr;
+
+	if (!slab)
+		return false;
+
+	/* Ignore pointers which are not the start of a used object */
+	obj_size = slab_obj_size(slab->class);
+	if (((unsigned long)ptr & (obj_size - 1)) || (void *)slab == ptr ||
+	    !slab->inuse)
+		return true;
+
+	sc = &hpctrl->slab_class[slab->class];
+	if (!slab->free)
+		sbi_list_add(&slab->head, &sc->partial_list);
 
-		n->addr = np->addr + size;
-		n->size = np->size - size;
-		sbi_list_add(&n->head, &np->head);
+	*obj = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	hpctrl->slab_free += obj_size;
 
-		np->size = size;
+	/* Keep one empty slab per class to avoid thrashing the heap */
+	if (!slab->inuse) {
+		sc->empty_count++;
+		if (sc->empty_count > 1)
+			slab_destroy(hpctrl, slab);
 	}
 
-	sbi_list_del(&np->head);
-	sbi_list_add_tail(&np->head, &hpctrl->used_space_list);
-	ret = (void *)np->addr;
+	return true;
+}
+
+static inline bool heap_cache_usable(struct sbi_heap_control *hpctrl)
+{
+	return hpctrl == &global_hpctrl && heap_cache_offset;
+}
+
+static void heap_cache_account(struct heap_cache *hc, unsigned int class,
+			       long count)
+{
+	hc->stats.cached += count * (long)slab_obj_size(class);
+	if (hc->stats.high_water < hc->stats.cached)
+		hc->stats.high_water = hc->stats.cached;
+}
+
+static void *heap_cache_alloc(unsigned int class)
+{
+	struct heap_cache *hc = sbi_scratch_thishart_offset_ptr(heap_cache_offset);
+	struct heap_cache_class *cc = &hc->class[class];
+	unsigned long count = cc->count;
+	void *obj;
+
+	if (count) {
+		hc->stats.hits++;
+		heap_cache_account(hc, class, -1);
+		return cc->objs[--cc->count];
+	}
+
+	/* Refill half of the cache so that frees have room as well */
+	spin_lock(&global_hpctrl.lock);
+	while (cc->count < HEAP_CACHE_OBJS / 2) {
+		obj = slab_alloc(&global_hpctrl, class);
+		if (!obj)
+			break;
+		cc->objs[cc->count++] = obj;
+	}
+	spin_unlock(&global_hpctrl.lock);
+	if (!cc->count)
+		return NULL;
+
+	hc->stats.refills++;
+	heap_cache_account(hc, class, cc->count - 1);
+	return cc->objs[--cc->count];
+}
+
+static bool heap_cache_free(void *ptr)
+{
+	struct heap_slab *slab = slab_lookup(&global_hpctrl, (unsigned long)ptr);
+	struct heap_cache *hc;
+	struct heap_cache_class *cc;
+	unsigned long i;
+
+	/*
+	 * The slab map bit of an allocated object can not change under
+	 * us so it is safe to look it up without holding the lock.
+	 */
+	if (!slab || ((unsigned long)ptr & (slab_obj_size(slab->class) - 1)) ||
+	    (void *)slab == ptr)
+		return false;
+
+	hc = sbi_scratch_thishart_offset_ptr(heap_cache_offset);
+	cc = &hc->class[slab->class];
+	if (cc->count == HEAP_CACHE_OBJS) {
+		/* Give the older half back to the slabs */
+		spin_lock(&global_hpctrl.lock);
+		for (i = 0; i < HEAP_CACHE_OBJS / 2; i++)
+			slab_free(&global_hpctrl, cc->objs[i]);
+		spin_unlock(&global_hpctrl.lock);
+		for (i = 0; i < HEAP_CACHE_OBJS / 2; i++)
+			cc->objs[i] = cc->objs[i + HEAP_CACHE_OBJS / 2];
+		cc->count -= HEAP_CACHE_OBJS / 2;
+		hc->stats.flushes++;
+		heap_cache_account(hc, slab->class, -(HEAP_CACHE_OBJS / 2));
+	}
+
+	cc->objs[cc->count++] = ptr;
+	heap_cache_account(hc, slab->class, 1);
+
+	return true;
+}
+
+static void *alloc_with_align(struct sbi_heap_control *hpctrl,
+			      size_t align, size_t size, unsigned long caller)
+{
+	unsigned long pad = 0;
+	void *ret = NULL;
+	int class;
+
+	if (!size)
+		return NULL;
+
+	class = slab_class(hpctrl, align, size);
+	if (class >= 0 && heap_cache_usable(hpctrl)) {
+		ret = heap_cache_alloc(class);
+		if (ret)
+			goto done;
+	}
+
+	spin_lock(&hpctrl->lock);
+
+	if (class >= 0)
+		ret = slab_alloc(hpctrl, class);
+	if (!ret) {
+		class = -1;
+		ret = heap_alloc_locked(hpctrl, align, size, &pad);
+	}
 
-out:
 	spin_unlock(&hpctrl->lock);
 
+done:
+	if (ret && hpctrl == &global_hpctrl)
+		sbi_heap_profile_record(caller, size,
+					(class >= 0) ? slab_obj_size(class) :
+					ROUNDUP(size, align) + pad);
+
 	return ret;
 }
 
 void *sbi_malloc_from(struct sbi_heap_control *hpctrl, size_t size)
 {
-	return alloc_with_align(hpctrl, HEAP_ALLOC_ALIGN, size);
+	return alloc_with_align(hpctrl, HEAP_ALLOC_ALIGN, size,
+				(unsigned long)__builtin_return_address(0));
 }
 
 void *sbi_aligned_alloc_from(struct sbi_heap_control *hpctrl,
@@ -156,12 +758,14 @@ void *sbi_aligned_alloc_from(struct sbi_heap_control *hpctrl,
 	if (size % alignment != 0)
 		return NULL;
 
-	return alloc_with_align(hpctrl, alignment, size);
+	return alloc_with_align(hpctrl, alignment, size,
+				(unsigned long)__builtin_return_address(0));
 }
 
 void *sbi_zalloc_from(struct sbi_heap_control *hpctrl, size_t size)
 {
-	void *ret = sbi_malloc_from(hpctrl, size);
+	void *ret = alloc_with_align(hpctrl, HEAP_ALLOC_ALIGN, size,
+				     (unsigned long)__builtin_return_address(0));
 
 	if (ret)
 		sbi_memset(ret, 0, size);
@@ -170,60 +774,38 @@ void *sbi_zalloc_from(struct sbi_heap_control *hpctrl, size_t size)
 
 void sbi_free_from(struct sbi_heap_control *hpctrl, void *ptr)
 {
-	struct heap_node *n, *np;
-
 	if (!ptr)
 		return;
 
-	spin_lock(&hpctrl->lock);
-
-	np = NULL;
-	sbi_list_for_each_entry(n, &hpctrl->used_space_list, head) {
-		if ((n->addr <= (unsigned long)ptr) &&
-		    ((unsigned long)ptr < (n->addr + n->size))) {
-			np = n;
-			break;
-		}
-	}
-	if (!np) {
-		spin_unlock(&hpctrl->lock);
+	if (heap_cache_usable(hpctrl) && heap_cache_free(ptr))
 		return;
-	}
 
-	sbi_list_del(&np->head);
+	spin_lock(&hpctrl->lock);
 
-	sbi_list_for_each_entry(n, &hpctrl->free_space_list, head) {
-		if ((np->addr + np->size) == n->addr) {
-			n->addr = np->addr;
-			n->size += np->size;
-			sbi_list_add_tail(&np->head, &hpctrl->free_node_list);
-			np = NULL;
-			break;
-		} else if (np->addr == (n->addr + n->size)) {
-			n->size += np->size;
-			sbi_list_add_tail(&np->head, &hpctrl->free_node_list);
-			np = NULL;
-			break;
-		} else if ((n->addr + n->size) < np->addr) {
-			sbi_list_add(&np->head, &n->head);
-			np = NULL;
-			break;
-		}
-	}
-	if (np)
-		sbi_list_add_tail(&np->head, &hpctrl->free_space_list);
+	if (!slab_free(hpctrl, ptr))
+		heap_free_locked(hpctrl, ptr);
 
 	spin_unlock(&hpctrl->lock);
 }
 
 unsigned long sbi_heap_free_space_from(struct sbi_heap_control *hpctrl)
 {
-	struct heap_node *n;
-	unsigned long ret = 0;
+	unsigned long ret;
+
+	spin_lock(&hpctrl->lock);
+	ret = tree_sum_size(hpctrl->free_space_root);
+	ret += hpctrl->slab_free;
+	spin_unlock(&hpctrl->lock);
+
+	return ret;
+}
+
+unsigned long sbi_heap_largest_free_space_from(struct sbi_heap_control *hpctrl)
+{
+	unsigned long ret;
 
 	spin_lock(&hpctrl->lock);
-	sbi_list_for_each_entry(n, &hpctrl->free_space_list, head)
-		ret += n->size;
+	ret = node_max_size(hpctrl->free_space_root);
 	spin_unlock(&hpctrl->lock);
 
 	return ret;
@@ -242,6 +824,7 @@ unsigned long sbi_heap_reserved_space_from(struct sbi_heap_control *hpctrl)
 int sbi_heap_init_new(struct sbi_heap_control *hpctrl, unsigned long base,
 		       unsigned long size)
 {
+	unsigned long i, map_size;
 	struct heap_node *n;
 
 	/* Initialize heap control */
@@ -249,21 +832,68 @@ int sbi_heap_init_new(struct sbi_heap_control *hpctrl, unsigned long base,
 	hpctrl->base = base;
 	hpctrl->size = size;
 	hpctrl->resv = 0;
-	SBI_INIT_LIST_HEAD(&hpctrl->free_node_list);
-	SBI_INIT_LIST_HEAD(&hpctrl->free_space_list);
-	SBI_INIT_LIST_HEAD(&hpctrl->used_space_list);
+	hpctrl->free_nodes = NULL;
+	hpctrl->free_node_count = 0;
+	hpctrl->free_space_root = NULL;
+	hpctrl->used_space_root = NULL;
 
-	/* Prepare free space list */
+	/* Prepare free space tree */
 	n = &hpctrl->init_free_space_node;
 	n->addr = base;
 	n->size = size;
-	sbi_list_add_tail(&n->head, &hpctrl->free_space_list);
+	tree_insert(&hpctrl->free_space_root, n);
+
+	/* Prepare slab size classes */
+	hpctrl->slab_free = 0;
+	for (i = 0; i < HEAP_SLAB_CLASS_COUNT; i++) {
+		SBI_INIT_LIST_HEAD(&hpctrl->slab_class[i].partial_list);
+		hpctrl->slab_class[i].empty_count = 0;
+	}
+
+	/*
+	 * Allocate the slab map from the heap itself. Without it, all
+	 * allocations are simply served from the free space list.
+	 */
+	hpctrl->slab_map_base = base & ~(HEAP_SLAB_SIZE - 1);
+	hpctrl->slab_map_bits = (base + size - hpctrl->slab_map_base +
+				 HEAP_SLAB_SIZE - 1) >> HEAP_SLAB_SHIFT;
+	map_size = BITS_TO_LONGS(hpctrl->slab_map_bits) * sizeof(unsigned long);
+	hpctrl->slab_map = heap_alloc_locked(hpctrl, HEAP_ALLOC_ALIGN, map_size,
+					       NULL);
+	if (hpctrl->slab_map) {
+		bitmap_zero(hpctrl->slab_map, hpctrl->slab_map_bits);
+		hpctrl->resv += ROUNDUP(map_size, HEAP_ALLOC_ALIGN);
+	}
 
 	return 0;
 }
 
+void sbi_heap_cache_stats(struct sbi_heap_cache_stats *stats)
+{
+	struct sbi_scratch *rscratch;
+	struct heap_cache *hc;
+
+	sbi_memset(stats, 0, sizeof(*stats));
+	if (!heap_cache_offset)
+		return;
+
+	sbi_for_each_hartindex(i) {
+		rscratch = sbi_hartindex_to_scratch(i);
+		if (!rscratch)
+			continue;
+		hc = sbi_scratch_offset_ptr(rscratch, heap_cache_offset);
+		stats->hits += hc->stats.hits;
+		stats->refills += hc->stats.refills;
+		stats->flushes += hc->stats.flushes;
+		stats->cached += hc->stats.cached;
+		stats->high_water += hc->stats.high_water;
+	}
+}
+
 int sbi_heap_init(struct sbi_scratch *scratch)
 {
+	int rc;
+
 	/* Sanity checks on heap offset and size */
 	if (!scratch->fw_heap_size ||
 	    (scratch->fw_heap_size & (HEAP_BASE_ALIGN - 1)) ||
@@ -272,9 +902,16 @@ int sbi_heap_init(struct sbi_scratch *scratch)
 	    (scratch->fw_heap_offset & (HEAP_BASE_ALIGN - 1)))
 		return SBI_EINVAL;
 
-	return sbi_heap_init_new(&global_hpctrl,
-				  scratch->fw_start + scratch->fw_heap_offset,
-				  scratch->fw_heap_size);
+	rc = sbi_heap_init_new(&global_hpctrl,
+			       scratch->fw_start + scratch->fw_heap_offset,
+			       scratch->fw_heap_size);
+	if (rc)
+		return rc;
+
+	/* Without scratch space, all HARTs share the global heap lock */
+	heap_cache_offset = sbi_scratch_alloc_type_offset(struct heap_cache);
+
+	return 0;
 }
 
 int sbi_heap_alloc_new(struct sbi_heap_control **hpctrl)
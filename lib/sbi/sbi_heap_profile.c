@@ -0,0 +1,109 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/riscv_locks.h>
+#include <sbi/sbi_console.h>
+#include <sbi/sbi_heap.h>
+
+/* Number of call sites tracked, must be a power of two */
+#define HEAP_PROFILE_SITES	64
+/* Number of call sites printed */
+#define HEAP_PROFILE_TOP	8
+
+struct heap_profile_site {
+	unsigned long caller;
+	unsigned long count;
+	unsigned long requested;
+	unsigned long granted;
+};
+
+static spinlock_t heap_profile_lock = SPIN_LOCK_INITIALIZER;
+static struct heap_profile_site heap_profile_sites[HEAP_PROFILE_SITES];
+/* Allocations from call sites which did not fit in the table */
+static struct heap_profile_site heap_profile_other;
+static struct heap_profile_site heap_profile_total;
+
+static void heap_profile_account(struct heap_profile_site *site,
+				 size_t size, size_t granted)
+{
+	site->count++;
+	site->requested += size;
+	site->granted += granted;
+}
+
+void sbi_heap_profile_record(unsigned long caller, size_t size,
+			     size_t granted)
+{
+	struct heap_profile_site *site = &heap_profile_other;
+	u32 i, idx = (caller >> 1) & (HEAP_PROFILE_SITES - 1);
+
+	spin_lock(&heap_profile_lock);
+
+	for (i = 0; i < HEAP_PROFILE_SITES; i++) {
+		idx = (idx + 1) & (HEAP_PROFILE_SITES - 1);
+		if (!heap_profile_sites[idx].count ||
+		    heap_profile_sites[idx].caller == caller) {
+			site = &heap_profile_sites[idx];
+			site->caller = caller;
+			break;
+		}
+	}
+
+	heap_profile_account(site, size, granted);
+	heap_profile_account(&heap_profile_total, size, granted);
+
+	spin_unlock(&heap_profile_lock);
+}
+
+void sbi_heap_profile_print(void)
+{
+	struct heap_profile_site *site, top[HEAP_PROFILE_TOP];
+	unsigned long free_space, largest, frag;
+	u32 i, j, top_count = 0;
+
+	spin_lock(&heap_profile_lock);
+
+	/* Keep the sites with the most granted bytes, largest first */
+	for (i = 0; i < HEAP_PROFILE_SITES; i++) {
+		site = &heap_profile_sites[i];
+		if (!site->count)
+			continue;
+		for (j = top_count; j > 0; j--) {
+			if (site->granted <= top[j - 1].granted)
+				break;
+			if (j < HEAP_PROFILE_TOP)
+				top[j] = top[j - 1];
+		}
+		if (j < HEAP_PROFILE_TOP) {
+			top[j] = *site;
+			if (top_count < HEAP_PROFILE_TOP)
+				top_count++;
+		}
+	}
+
+	sbi_printf("Firmware Heap Profile       : "
+		   "%lu allocs, %lu B requested, %lu B granted, %lu B padding\n",
+		   heap_profile_total.count, heap_profile_total.requested,
+		   heap_profile_total.granted,
+		   heap_profile_total.granted - heap_profile_total.requested);
+	for (i = 0; i < top_count; i++)
+		sbi_printf("%s0x%lx: %lu allocs, %lu B granted, %lu B padding\n",
+			   (i) ? "                              " :
+				 "Firmware Heap Top Callers   : ",
+			   top[i].caller, top[i].count, top[i].granted,
+			   top[i].granted - top[i].requested);
+	if (heap_profile_other.count)
+		sbi_printf("                              "
+			   "others: %lu allocs, %lu B granted\n",
+			   heap_profile_other.count, heap_profile_other.granted);
+
+	spin_unlock(&heap_profile_lock);
+
+	free_space = sbi_heap_free_space();
+	largest = sbi_heap_largest_free_space();
+	frag = (free_space) ? 100 - (largest * 100) / free_space : 0;
+	sbi_printf("Firmware Heap Fragmentation : "
+		   "%lu B largest free block, %lu%% of free space fragmented\n",
+		   largest, frag);
+}
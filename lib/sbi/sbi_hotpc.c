@@ -0,0 +1,151 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/sbi_console.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_heap.h>
+#include <sbi/sbi_hotpc.h>
+#include <sbi/sbi_scratch.h>
+
+/* Number of PCs tracked per hart, must be a power of two */
+#define HOTPC_ENTRIES		64
+/* Number of slots probed before evicting the coldest one */
+#define HOTPC_PROBE_MAX		8
+/* Number of PCs printed per hart */
+#define HOTPC_DUMP_MAX		16
+
+struct hotpc_entry {
+	unsigned long pc;
+	u32 kind;
+	u32 count;
+	u64 cycles;
+};
+
+struct hotpc_table {
+	struct hotpc_entry entries[HOTPC_ENTRIES];
+	/* Number of entries evicted to make room for a new PC */
+	u32 evicted;
+};
+
+static const char *const hotpc_kind_names[SBI_HOTPC_KIND_MAX] = {
+	[SBI_HOTPC_ILLEGAL_INSN] = "illegal",
+	[SBI_HOTPC_MISALIGNED_LOAD] = "mis-load",
+	[SBI_HOTPC_MISALIGNED_STORE] = "mis-store",
+};
+
+static unsigned long hotpc_off;
+
+static struct hotpc_table *hotpc_table_ptr(struct sbi_scratch *scratch)
+{
+	if (!hotpc_off || !scratch)
+		return NULL;
+
+	return sbi_scratch_read_type(scratch, struct hotpc_table *, hotpc_off);
+}
+
+void sbi_hotpc_record(enum sbi_hotpc_kind kind, unsigned long pc,
+		      unsigned long start)
+{
+	struct hotpc_table *t = hotpc_table_ptr(sbi_scratch_thishart_ptr());
+	unsigned long cycles = csr_read(CSR_MCYCLE) - start;
+	struct hotpc_entry *e, *victim = NULL;
+	u32 i, idx;
+
+	if (!t)
+		return;
+
+	/*
+	 * Open addressing with a bounded probe. When neither the PC nor a
+	 * free slot is found, the least used probed entry is replaced so
+	 * that the table converges to the hottest PCs.
+	 */
+	idx = ((pc >> 1) ^ (pc >> 7) ^ kind) & (HOTPC_ENTRIES - 1);
+	for (i = 0; i < HOTPC_PROBE_MAX; i++) {
+		e = &t->entries[(idx + i) & (HOTPC_ENTRIES - 1)];
+		if (e->count && e->pc == pc && e->kind == kind)
+			goto found;
+		if (!e->count)
+			goto fill;
+		if (!victim || e->count < victim->count)
+			victim = e;
+	}
+
+	e = victim;
+	t->evicted++;
+fill:
+	e->pc = pc;
+	e->kind = kind;
+	e->count = 0;
+	e->cycles = 0;
+found:
+	e->count++;
+	e->cycles += cycles;
+}
+
+static void hotpc_dump_hart(u32 hartindex, struct hotpc_table *t)
+{
+	bool printed[HOTPC_ENTRIES] = { 0 };
+	struct hotpc_entry *e, *best;
+	u32 i, j, best_idx = 0;
+
+	for (i = 0; i < HOTPC_DUMP_MAX; i++) {
+		best = NULL;
+		for (j = 0; j < HOTPC_ENTRIES; j++) {
+			e = &t->entries[j];
+			if (!e->count || printed[j])
+				continue;
+			if (!best || e->cycles > best->cycles) {
+				best = e;
+				best_idx = j;
+			}
+		}
+		if (!best)
+			break;
+		printed[best_idx] = true;
+
+		if (!i)
+			sbi_printf("hart%u emulation hot PCs (%u evicted):\n",
+				   sbi_hartindex_to_hartid(hartindex),
+				   t->evicted);
+		sbi_printf("  %-9s pc=0x%lx count=%u cycles=%lu\n",
+			   hotpc_kind_names[best->kind], best->pc,
+			   best->count, (unsigned long)best->cycles);
+	}
+}
+
+void sbi_hotpc_dump(void)
+{
+	struct hotpc_table *t;
+
+	sbi_for_each_hartindex(i) {
+		t = hotpc_table_ptr(sbi_hartindex_to_scratch(i));
+		if (t)
+			hotpc_dump_hart(i, t);
+	}
+}
+
+int sbi_hotpc_init(struct sbi_scratch *scratch, bool cold_boot)
+{
+	struct hotpc_table *t;
+
+	if (cold_boot) {
+		hotpc_off = sbi_scratch_alloc_offset(sizeof(t));
+		if (!hotpc_off)
+			return SBI_ENOMEM;
+	} else if (!hotpc_off) {
+		return SBI_ENOMEM;
+	}
+
+	t = sbi_scratch_read_type(scratch, struct hotpc_table *, hotpc_off);
+	if (!t) {
+		t = sbi_zalloc(sizeof(*t));
+		if (!t)
+			return SBI_ENOMEM;
+		sbi_scratch_write_type(scratch, struct hotpc_table *,
+				       hotpc_off, t);
+	}
+
+	return 0;
+}
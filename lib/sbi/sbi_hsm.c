@@ -399,6 +399,9 @@ int sbi_hsm_hart_stop(struct sbi_scratch *scratch, bool exitnow)
 
 static int __sbi_hsm_suspend_default(struct sbi_scratch *scratch)
 {
+	/* Use the idle time to write out buffered console output */
+	sbi_console_drain();
+
 	/* Wait for interrupt */
 	wfi();
 
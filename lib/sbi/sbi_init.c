@@ -33,6 +33,7 @@
 #include <sbi/sbi_string.h>
 #include <sbi/sbi_timer.h>
 #include <sbi/sbi_tlb.h>
+#include <sbi/sbi_hotpc.h>
 #include <sbi/sbi_version.h>
 #include <sbi/sbi_unit_test.h>
 
@@ -82,6 +83,7 @@ static void sbi_boot_print_general(struct sbi_scratch *scratch)
 	const struct sbi_system_suspend_device *susp_dev;
 	const struct sbi_cppc_device *cppc_dev;
 	const struct sbi_platform *plat = sbi_platform_ptr(scratch);
+	struct sbi_heap_cache_stats heap_cache;
 
 	if (scratch->options & SBI_SCRATCH_NO_BOOT_PRINTS)
 		return;
@@ -139,6 +141,12 @@ static void sbi_boot_print_general(struct sbi_scratch *scratch)
 		   (u32)(sbi_heap_reserved_space() / 1024),
 		   (u32)(sbi_heap_used_space() / 1024),
 		   (u32)(sbi_heap_free_space() / 1024));
+	sbi_heap_cache_stats(&heap_cache);
+	sbi_printf("Firmware Heap Cache         : "
+		   "%lu hits, %lu refills, %lu flushes, %lu B (high-water)\n",
+		   heap_cache.hits, heap_cache.refills, heap_cache.flushes,
+		   heap_cache.high_water);
+	sbi_heap_profile_print();
 	sbi_printf("Firmware Scratch Size       : "
 		   "%d B (total), %d B (used), %d B (free)\n",
 		   SBI_SCRATCH_SIZE,
@@ -200,6 +208,8 @@ static void sbi_boot_print_hart(struct sbi_scratch *scratch, u32 hartid)
 		   sbi_hart_mhpm_mask(scratch));
 	sbi_printf("Boot HART Debug Triggers    : %d triggers\n",
 		   sbi_dbtr_get_total_triggers());
+	sbi_printf("Boot HART TLB Flush Limit   : %lu bytes\n",
+		   sbi_tlb_range_flush_limit(scratch));
 	sbi_hart_delegation_dump(scratch, "Boot HART ", "           ");
 }
 
@@ -328,6 +338,14 @@ static void __noreturn init_coldboot(struct sbi_scratch *scratch, u32 hartid)
 		sbi_hart_hang();
 	}
 
+	rc = sbi_hotpc_init(scratch, true);
+	if (rc)
+		sbi_hart_hang();
+
+	rc = sbi_console_async_init(scratch, true);
+	if (rc)
+		sbi_hart_hang();
+
 	rc = sbi_dbtr_init(scratch, true);
 	if (rc)
 		sbi_hart_hang();
@@ -486,6 +504,14 @@ static void __noreturn init_warm_startup(struct sbi_scratch *scratch,
 	if (rc)
 		sbi_hart_hang();
 
+	rc = sbi_hotpc_init(scratch, false);
+	if (rc)
+		sbi_hart_hang();
+
+	rc = sbi_console_async_init(scratch, false);
+	if (rc)
+		sbi_hart_hang();
+
 	rc = sbi_dbtr_init(scratch, false);
 	if (rc)
 		sbi_hart_hang();
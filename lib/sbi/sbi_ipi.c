@@ -47,7 +47,7 @@ static const struct sbi_ipi_event_ops *ipi_ops_array[SBI_IPI_EVENT_MAX];
 static int sbi_ipi_send(struct sbi_scratch *scratch, u32 remote_hartindex,
 			u32 event, void *data)
 {
-	int ret = 0;
+	int rc, ret = 0;
 	struct sbi_scratch *remote_scratch = NULL;
 	struct sbi_ipi_data *ipi_data;
 	const struct sbi_ipi_event_ops *ipi_ops;
@@ -66,7 +66,13 @@ static int sbi_ipi_send(struct sbi_scratch *scratch, u32 remote_hartindex,
 	if (ipi_ops->update) {
 		ret = ipi_ops->update(scratch, remote_scratch,
 				      remote_hartindex, data);
-		if (ret != SBI_IPI_UPDATE_SUCCESS)
+		/*
+		 * On SBI_IPI_UPDATE_RETRY, the update may have been applied
+		 * partially so still kick the remote HART to make sure it
+		 * drains its pending work before we wait on it.
+		 */
+		if (ret != SBI_IPI_UPDATE_SUCCESS &&
+		    ret != SBI_IPI_UPDATE_RETRY)
 			return ret;
 	} else if (scratch == remote_scratch) {
 		/*
@@ -87,14 +93,31 @@ static int sbi_ipi_send(struct sbi_scratch *scratch, u32 remote_hartindex,
 	 * the ipi_type was previously zero.
 	 */
 	if (!__atomic_fetch_or(&ipi_data->ipi_type,
-				BIT(event), __ATOMIC_RELAXED))
-		ret = sbi_ipi_raw_send(remote_hartindex, false);
+				BIT(event), __ATOMIC_RELAXED)) {
+		rc = sbi_ipi_raw_send(remote_hartindex, false);
+		if (rc)
+			return rc;
+	}
 
 	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_IPI_SENT);
 
 	return ret;
 }
 
+static void sbi_ipi_wait(struct sbi_scratch *scratch, u32 remote_hartindex,
+			 u32 event)
+{
+	struct sbi_scratch *remote_scratch;
+	const struct sbi_ipi_event_ops *ipi_ops = ipi_ops_array[event];
+
+	if (!ipi_ops->wait)
+		return;
+
+	remote_scratch = sbi_hartindex_to_scratch(remote_hartindex);
+	if (remote_scratch)
+		ipi_ops->wait(scratch, remote_scratch);
+}
+
 static int sbi_ipi_sync(struct sbi_scratch *scratch, u32 event)
 {
 	const struct sbi_ipi_event_ops *ipi_ops;
@@ -118,9 +141,8 @@ static int sbi_ipi_sync(struct sbi_scratch *scratch, u32 event)
 int sbi_ipi_send_many(ulong hmask, ulong hbase, u32 event, void *data)
 {
 	int rc = 0;
-	bool retry_needed;
 	ulong i;
-	struct sbi_hartmask target_mask;
+	struct sbi_hartmask target_mask, retry_mask;
 	struct sbi_domain *dom = sbi_domain_thishart_ptr();
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 
@@ -157,19 +179,30 @@ int sbi_ipi_send_many(ulong hmask, ulong hbase, u32 event, void *data)
 	}
 
 	/* Send IPIs */
-	do {
-		retry_needed = false;
-		sbi_hartmask_for_each_hartindex(i, &target_mask) {
+	SBI_HARTMASK_INIT(&retry_mask);
+	sbi_hartmask_for_each_hartindex(i, &target_mask) {
+		rc = sbi_ipi_send(scratch, i, event, data);
+		if (rc < 0)
+			goto done;
+		if (rc == SBI_IPI_UPDATE_RETRY)
+			sbi_hartmask_set_hartindex(i, &retry_mask);
+		rc = 0;
+	}
+
+	/*
+	 * Targets which could not accept the update are handled one at
+	 * a time: park until the target makes room and retry it directly
+	 * instead of re-walking the whole target mask.
+	 */
+	sbi_hartmask_for_each_hartindex(i, &retry_mask) {
+		do {
+			sbi_ipi_wait(scratch, i, event);
 			rc = sbi_ipi_send(scratch, i, event, data);
 			if (rc < 0)
 				goto done;
-			if (rc == SBI_IPI_UPDATE_RETRY)
-				retry_needed = true;
-			else
-				sbi_hartmask_clear_hartindex(i, &target_mask);
-			rc = 0;
-		}
-	} while (retry_needed);
+		} while (rc == SBI_IPI_UPDATE_RETRY);
+		rc = 0;
+	}
 
 done:
 	/* Sync IPIs */
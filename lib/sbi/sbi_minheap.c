@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/sbi_bitops.h>
+#include <sbi/sbi_minheap.h>
+
+/* Find the node at 1-based level order position @pos */
+static struct sbi_minheap_node *minheap_node_at(struct sbi_minheap *h,
+						unsigned long pos)
+{
+	struct sbi_minheap_node *node = h->root;
+	int bit;
+
+	/* Bits below the most significant one select left or right */
+	for (bit = sbi_fls(pos) - 1; bit >= 0; bit--)
+		node = (pos & BIT(bit)) ? node->right : node->left;
+
+	return node;
+}
+
+static void minheap_replace_child(struct sbi_minheap *h,
+				  struct sbi_minheap_node *parent,
+				  struct sbi_minheap_node *old,
+				  struct sbi_minheap_node *new)
+{
+	if (!parent)
+		h->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+/* Exchange the tree positions of @node and its parent */
+static void minheap_swap_parent(struct sbi_minheap *h,
+				struct sbi_minheap_node *node)
+{
+	struct sbi_minheap_node *parent = node->parent;
+	struct sbi_minheap_node *left = node->left, *right = node->right;
+
+	minheap_replace_child(h, parent->parent, parent, node);
+	node->parent = parent->parent;
+
+	if (parent->left == node) {
+		node->left = parent;
+		node->right = parent->right;
+		if (node->right)
+			node->right->parent = node;
+	} else {
+		node->right = parent;
+		node->left = parent->left;
+		if (node->left)
+			node->left->parent = node;
+	}
+	parent->parent = node;
+
+	parent->left = left;
+	if (left)
+		left->parent = parent;
+	parent->right = right;
+	if (right)
+		right->parent = parent;
+}
+
+static void minheap_sift_up(struct sbi_minheap *h,
+			    struct sbi_minheap_node *node)
+{
+	while (node->parent && node->key < node->parent->key)
+		minheap_swap_parent(h, node);
+}
+
+static void minheap_sift_down(struct sbi_minheap *h,
+			      struct sbi_minheap_node *node)
+{
+	struct sbi_minheap_node *child;
+
+	while (node->left) {
+		child = node->left;
+		if (node->right && node->right->key < child->key)
+			child = node->right;
+		if (node->key <= child->key)
+			break;
+		minheap_swap_parent(h, child);
+	}
+}
+
+void sbi_minheap_insert(struct sbi_minheap *h, struct sbi_minheap_node *node)
+{
+	struct sbi_minheap_node *parent;
+
+	node->left = node->right = NULL;
+	h->count++;
+	if (h->count == 1) {
+		node->parent = NULL;
+		h->root = node;
+		return;
+	}
+
+	/* The new node becomes the last one in level order */
+	parent = minheap_node_at(h, h->count >> 1);
+	if (h->count & 1)
+		parent->right = node;
+	else
+		parent->left = node;
+	node->parent = parent;
+
+	minheap_sift_up(h, node);
+}
+
+void sbi_minheap_remove(struct sbi_minheap *h, struct sbi_minheap_node *node)
+{
+	struct sbi_minheap_node *last = minheap_node_at(h, h->count);
+
+	/* Detach the last node in level order */
+	minheap_replace_child(h, last->parent, last, NULL);
+	h->count--;
+
+	/* Move the last node into the hole unless it was the one removed */
+	if (last != node) {
+		last->parent = node->parent;
+		last->left = node->left;
+		last->right = node->right;
+		minheap_replace_child(h, node->parent, node, last);
+		if (last->left)
+			last->left->parent = last;
+		if (last->right)
+			last->right->parent = last;
+
+		if (last->parent && last->key < last->parent->key)
+			minheap_sift_up(h, last);
+		else
+			minheap_sift_down(h, last);
+	}
+
+	node->parent = node->left = node->right = NULL;
+}
+
+void sbi_minheap_update(struct sbi_minheap *h, struct sbi_minheap_node *node,
+			u64 key)
+{
+	u64 old = node->key;
+
+	node->key = key;
+	if (key < old)
+		minheap_sift_up(h, node);
+	else
+		minheap_sift_down(h, node);
+}
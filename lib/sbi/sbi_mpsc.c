@@ -0,0 +1,127 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/riscv_barrier.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_math.h>
+#include <sbi/sbi_mpsc.h>
+#include <sbi/sbi_string.h>
+
+static inline u32 mpsc_roundup_entries(u32 entries)
+{
+	return 1UL << log2roundup(entries);
+}
+
+unsigned long sbi_mpsc_mem_size(u32 entries, u32 entry_size)
+{
+	unsigned long n = mpsc_roundup_entries(entries);
+
+	return n * sizeof(unsigned long) + n * entry_size;
+}
+
+int sbi_mpsc_init(struct sbi_mpsc *q, void *mem, u32 entries, u32 entry_size)
+{
+	u32 i;
+
+	if (!q || !mem || !entries || !entry_size)
+		return SBI_EINVAL;
+
+	q->num_entries = mpsc_roundup_entries(entries);
+	q->entry_size = entry_size;
+	q->seq = mem;
+	q->queue = (char *)mem + q->num_entries * sizeof(unsigned long);
+	sbi_memset(q->queue, 0, (size_t)q->num_entries * entry_size);
+
+	/* Slot i is free for the producer claiming position i */
+	for (i = 0; i < q->num_entries; i++)
+		q->seq[i] = i;
+
+	q->tail = 0;
+	ATOMIC_INIT(&q->head, 0);
+	smp_wmb();
+
+	return 0;
+}
+
+int sbi_mpsc_enqueue(struct sbi_mpsc *q, void *data)
+{
+	unsigned long pos, seq, mask;
+	long diff;
+
+	if (!q || !data)
+		return SBI_EINVAL;
+
+	mask = q->num_entries - 1;
+	pos = atomic_read(&q->head);
+	while (1) {
+		seq = __smp_load_acquire(&q->seq[pos & mask]);
+		diff = (long)(seq - pos);
+		if (diff == 0) {
+			/* Slot is free, try to claim it */
+			if (atomic_cmpxchg(&q->head, pos, pos + 1) == pos)
+				break;
+			pos = atomic_read(&q->head);
+		} else if (diff < 0) {
+			/* Consumer has not released this slot yet */
+			return SBI_ENOSPC;
+		} else {
+			/* Another producer claimed it, reload */
+			pos = atomic_read(&q->head);
+		}
+	}
+
+	sbi_memcpy((char *)q->queue + (pos & mask) * q->entry_size,
+		   data, q->entry_size);
+
+	/* Publish the entry to the consumer */
+	__smp_store_release(&q->seq[pos & mask], pos + 1);
+
+	return 0;
+}
+
+int sbi_mpsc_dequeue(struct sbi_mpsc *q, void *data)
+{
+	unsigned long pos, mask;
+
+	if (!q || !data)
+		return SBI_EINVAL;
+
+	mask = q->num_entries - 1;
+	pos = q->tail;
+	if (__smp_load_acquire(&q->seq[pos & mask]) != pos + 1)
+		return SBI_ENOENT;
+
+	sbi_memcpy(data, (char *)q->queue + (pos & mask) * q->entry_size,
+		   q->entry_size);
+
+	/* Hand the slot back to producers for the next lap */
+	__smp_store_release(&q->seq[pos & mask], pos + q->num_entries);
+	q->tail = pos + 1;
+
+	return 0;
+}
+
+bool sbi_mpsc_is_full(struct sbi_mpsc *q)
+{
+	unsigned long pos;
+
+	if (!q)
+		return false;
+
+	pos = atomic_read(&q->head);
+	return (long)(__smp_load_acquire(&q->seq[pos & (q->num_entries - 1)]) -
+		      pos) < 0;
+}
+
+bool sbi_mpsc_is_empty(struct sbi_mpsc *q)
+{
+	unsigned long pos;
+
+	if (!q)
+		return true;
+
+	pos = q->tail;
+	return __smp_load_acquire(&q->seq[pos & (q->num_entries - 1)]) !=
+	       pos + 1;
+}
@@ -20,6 +20,7 @@
 #include <sbi/sbi_scratch.h>
 #include <sbi/sbi_string.h>
 #include <sbi/sbi_sse.h>
+#include <sbi/sbi_trap_hist.h>
 
 /** Information about hardware counters */
 struct sbi_pmu_hw_event {
@@ -71,16 +72,30 @@ struct sbi_pmu_hart_state {
 	uint32_t hartid;
 	/* Counter to enabled event mapping */
 	uint32_t active_events[SBI_PMU_HW_CTR_MAX + SBI_PMU_FW_CTR_MAX];
+	/* Bitmap of programmable hardware counters mapped to an event */
+	unsigned long hw_counters_used;
+	/* Bitmap of firmware counters mapped to an event */
+	unsigned long fw_counters_used;
 	/* Bitmap of firmware counters started */
 	unsigned long fw_counters_started;
+	/* Bitmap of firmware counters configured for each SBI firmware event */
+	unsigned long fw_event_counters[SBI_PMU_FW_MAX];
 	/* if true, SSE is enabled */
 	bool sse_enabled;
+	/* Snapshot shared memory address or PMU_SNAPSHOT_SHMEM_INVALID */
+	unsigned long snapshot_shmem;
 	/*
 	 * Counter values for SBI firmware events and event codes
 	 * for platform firmware events. Both are mutually exclusive
 	 * and hence can optimally share the same memory.
 	 */
 	uint64_t fw_counters_data[SBI_PMU_FW_CTR_MAX];
+	/*
+	 * Internal event data of SBI_PMU_FW_PLATFORM counters when the
+	 * platform does not provide custom firmware events. In that case
+	 * fw_counters_data holds the counter value for these counters.
+	 */
+	uint64_t fw_internal_data[SBI_PMU_FW_CTR_MAX];
 	/* HW events configuration parameters from
 	 * sbi_pmu_ctr_cfg_match() command which are
 	 * used for restoring RAW hardware events after
@@ -89,6 +104,9 @@ struct sbi_pmu_hart_state {
 	struct sbi_pmu_hw_event_config hw_counters_cfg[SBI_PMU_HW_CTR_MAX];
 };
 
+/* Snapshot shared memory is disabled */
+#define PMU_SNAPSHOT_SHMEM_INVALID	(-1UL)
+
 /** Offset of pointer to PMU HART state in scratch space */
 static unsigned long phs_ptr_offset;
 
@@ -109,12 +127,52 @@ static struct sbi_pmu_hw_event *hw_event_map;
 
 /* Maximum number of hardware events available */
 static uint32_t num_hw_events;
+
+/* Number of slots in the raw event selector hash table */
+#define PMU_RAW_HASH_SLOTS	(2 * SBI_PMU_HW_EVENT_MAX)
+
+/* hw_event_map indices of non-raw events sorted by start_idx */
+static u16 *hw_range_index;
+static uint32_t num_hw_ranges;
+/* Open addressing hash of raw event selectors (hw_event_map index + 1) */
+static u16 *hw_raw_hash;
+/* hw_event_map index of one raw event for each distinct select_mask */
+static u16 *hw_raw_masks;
+static uint32_t num_hw_raw_masks;
 /* Maximum number of hardware counters available */
 static uint32_t num_hw_ctrs;
 
 /* Maximum number of counters available */
 static uint32_t total_ctrs;
 
+/*
+ * SBI_PMU_FW_PLATFORM counters count OpenSBI internal events unless
+ * the platform PMU device provides its own custom firmware events.
+ */
+static inline bool pmu_fw_internal_events(void)
+{
+	return !pmu_dev || !pmu_dev->fw_event_validate_encoding;
+}
+
+/* Check that event_data selects an internal event with valid parameters */
+static bool pmu_fw_internal_valid(uint64_t edata)
+{
+	switch (SBI_PMU_FW_INTERNAL_ID(edata)) {
+	case SBI_PMU_FW_INTERNAL_TLB_MERGED:
+	case SBI_PMU_FW_INTERNAL_TLB_PROMOTED:
+		return !(edata >> 8);
+#ifdef CONFIG_SBI_TRAP_HIST
+	case SBI_PMU_FW_INTERNAL_TRAP_LATENCY:
+		return SBI_PMU_FW_INTERNAL_BUCKET(edata) < SBI_TRAP_HIST_BUCKETS &&
+		       !SBI_PMU_FW_INTERNAL_EID(edata);
+	case SBI_PMU_FW_INTERNAL_ECALL_LATENCY:
+		return SBI_PMU_FW_INTERNAL_BUCKET(edata) < SBI_TRAP_HIST_BUCKETS;
+#endif
+	default:
+		return false;
+	}
+}
+
 /* Helper macros to retrieve event idx and code type */
 #define get_cidx_type(x) \
   (((x) & SBI_PMU_EVENT_IDX_TYPE_MASK) >> SBI_PMU_EVENT_IDX_TYPE_OFFSET)
@@ -164,12 +222,16 @@ static int pmu_event_validate(struct sbi_pmu_hart_state *phs,
 		    event_idx_code > SBI_PMU_FW_PLATFORM)
 			return SBI_EINVAL;
 
-		if (SBI_PMU_FW_PLATFORM == event_idx_code &&
-		    pmu_dev && pmu_dev->fw_event_validate_encoding)
-			return pmu_dev->fw_event_validate_encoding(phs->hartid,
-							           edata);
-		else
-			event_idx_code_max = SBI_PMU_FW_MAX;
+		if (SBI_PMU_FW_PLATFORM == event_idx_code) {
+			if (!pmu_fw_internal_events())
+				return pmu_dev->fw_event_validate_encoding(
+							phs->hartid, edata);
+			if (!pmu_fw_internal_valid(edata))
+				return SBI_EINVAL;
+			return event_idx_type;
+		}
+
+		event_idx_code_max = SBI_PMU_FW_MAX;
 		break;
 	case SBI_PMU_EVENT_TYPE_HW_CACHE:
 		cache_ops_result = event_idx_code &
@@ -235,6 +297,50 @@ static bool pmu_ctr_idx_validate(unsigned long cbase, unsigned long cmask)
 	return (cbase + last) < total_ctrs;
 }
 
+static uint64_t pmu_ctr_read_fw(struct sbi_pmu_hart_state *phs,
+			       uint32_t cidx, uint32_t event_code)
+{
+	if (SBI_PMU_FW_PLATFORM == event_code && !pmu_fw_internal_events()) {
+		if (pmu_dev->fw_counter_read_value)
+			return pmu_dev->fw_counter_read_value(phs->hartid,
+							      cidx - num_hw_ctrs);
+		return 0;
+	}
+
+	return phs->fw_counters_data[cidx - num_hw_ctrs];
+}
+
+static uint64_t pmu_ctr_read_hw(uint32_t cidx)
+{
+#if __riscv_xlen == 32
+	uint32_t lo, hi, tmp;
+
+	do {
+		hi = csr_read_num(CSR_MCYCLEH + cidx);
+		lo = csr_read_num(CSR_MCYCLE + cidx);
+		tmp = csr_read_num(CSR_MCYCLEH + cidx);
+	} while (hi != tmp);
+
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return csr_read_num(CSR_MCYCLE + cidx);
+#endif
+}
+
+static bool pmu_ctr_hw_overflown(uint32_t cidx)
+{
+	if (cidx < 3 || cidx >= num_hw_ctrs ||
+	    !sbi_hart_has_extension(sbi_scratch_thishart_ptr(),
+				    SBI_HART_EXT_SSCOFPMF))
+		return false;
+
+#if __riscv_xlen == 32
+	return csr_read_num(CSR_MHPMEVENT3H + cidx - 3) & MHPMEVENTH_OF;
+#else
+	return csr_read_num(CSR_MHPMEVENT3 + cidx - 3) & MHPMEVENT_OF;
+#endif
+}
+
 int sbi_pmu_ctr_fw_read(unsigned long cidx, uint64_t *cval, bool high_bits)
 {
 	int event_idx_type;
@@ -261,15 +367,116 @@ int sbi_pmu_ctr_fw_read(unsigned long cidx, uint64_t *cval, bool high_bits)
 	    event_code > SBI_PMU_FW_PLATFORM)
 		return SBI_EINVAL;
 
-	if (SBI_PMU_FW_PLATFORM == event_code) {
-		if (pmu_dev && pmu_dev->fw_counter_read_value)
-			*cval = pmu_dev->fw_counter_read_value(phs->hartid,
-							       cidx -
-							       num_hw_ctrs);
+	*cval = pmu_ctr_read_fw(phs, cidx, event_code);
+
+	return 0;
+}
+
+static u32 pmu_raw_hash(uint64_t select, uint64_t select_mask)
+{
+	uint64_t key = (select ^ (select_mask * 0x9e3779b97f4a7c15ULL)) *
+		       0x9e3779b97f4a7c15ULL;
+
+	return (key >> 32) & (PMU_RAW_HASH_SLOTS - 1);
+}
+
+static void pmu_index_hw_event(u32 eidx)
+{
+	struct sbi_pmu_hw_event *event = &hw_event_map[eidx];
+	u32 i, slot;
+
+	if (event->start_idx == SBI_PMU_EVENT_RAW_IDX) {
+		slot = pmu_raw_hash(event->select, event->select_mask);
+		while (hw_raw_hash[slot])
+			slot = (slot + 1) & (PMU_RAW_HASH_SLOTS - 1);
+		hw_raw_hash[slot] = eidx + 1;
+
+		for (i = 0; i < num_hw_raw_masks; i++) {
+			if (hw_event_map[hw_raw_masks[i]].select_mask ==
+			    event->select_mask)
+				return;
+		}
+		hw_raw_masks[num_hw_raw_masks++] = eidx;
+		return;
+	}
+
+	/* Ranges never overlap so sorting by start also sorts by end */
+	for (i = num_hw_ranges; i > 0; i--) {
+		if (hw_event_map[hw_range_index[i - 1]].start_idx <
+		    event->start_idx)
+			break;
+		hw_range_index[i] = hw_range_index[i - 1];
+	}
+	hw_range_index[i] = eidx;
+	num_hw_ranges++;
+}
+
+/**
+ * Get the counters which can count the given hardware event
+ * @param event_idx Event index as per SBI specification
+ * @param data      Event data (selector value of raw events)
+ *
+ * Return a bitmap of the hardware counters mapped to the event
+ */
+static u32 pmu_hw_event_counters(unsigned long event_idx, uint64_t data)
+{
+	struct sbi_pmu_hw_event *event;
+	uint64_t select_mask;
+	u32 i, lo, hi, mid, slot, counters = 0;
+
+	if (event_idx == SBI_PMU_EVENT_RAW_IDX ||
+	    event_idx == SBI_PMU_EVENT_RAW_V2_IDX) {
+		/* The non-event map bits of data should match the selector */
+		for (i = 0; i < num_hw_raw_masks; i++) {
+			select_mask = hw_event_map[hw_raw_masks[i]].select_mask;
+			slot = pmu_raw_hash(data & select_mask, select_mask);
+			while (hw_raw_hash[slot]) {
+				event = &hw_event_map[hw_raw_hash[slot] - 1];
+				if (event->select_mask == select_mask &&
+				    event->select == (data & select_mask)) {
+					counters |= event->counters;
+					break;
+				}
+				slot = (slot + 1) & (PMU_RAW_HASH_SLOTS - 1);
+			}
+		}
+		return counters;
+	}
+
+	/* Find the last range starting at or below event_idx */
+	lo = 0;
+	hi = num_hw_ranges;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (hw_event_map[hw_range_index[mid]].start_idx <= event_idx)
+			lo = mid + 1;
 		else
-			*cval = 0;
-	} else
-		*cval = phs->fw_counters_data[cidx - num_hw_ctrs];
+			hi = mid;
+	}
+	if (!lo)
+		return 0;
+
+	event = &hw_event_map[hw_range_index[lo - 1]];
+	return (event_idx <= event->end_idx) ? event->counters : 0;
+}
+
+int sbi_pmu_ctr_read(unsigned long cidx, uint64_t *cval)
+{
+	int event_idx_type;
+	uint32_t event_code;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (unlikely(!phs))
+		return SBI_EINVAL;
+
+	event_idx_type = pmu_ctr_validate(phs, cidx, &event_code);
+	if (event_idx_type < 0)
+		return SBI_EINVAL;
+
+	if (event_idx_type == SBI_PMU_EVENT_TYPE_FW)
+		*cval = pmu_ctr_read_fw(phs, cidx, event_code);
+	else
+		*cval = pmu_ctr_read_hw(cidx);
 
 	return 0;
 }
@@ -313,6 +520,7 @@ static int pmu_add_hw_event_map(u32 eidx_start, u32 eidx_end, u32 cmap,
 	/* Map the only the counters that are available in the hardware */
 	event->counters = cmap & ctr_avail_mask;
 	event->select = select;
+	pmu_index_hw_event(num_hw_events);
 	num_hw_events++;
 
 	return 0;
@@ -474,9 +682,8 @@ static int pmu_ctr_start_fw(struct sbi_pmu_hart_state *phs,
 	if (phs->fw_counters_started & BIT(cidx - num_hw_ctrs))
 		return SBI_EALREADY_STARTED;
 
-	if (SBI_PMU_FW_PLATFORM == event_code) {
-		if (!pmu_dev ||
-		    !pmu_dev->fw_counter_write_value ||
+	if (SBI_PMU_FW_PLATFORM == event_code && !pmu_fw_internal_events()) {
+		if (!pmu_dev->fw_counter_write_value ||
 		    !pmu_dev->fw_counter_start) {
 			return SBI_EINVAL;
 		}
@@ -513,9 +720,8 @@ static void pmu_update_inhibit_flags(unsigned long flags, uint64_t *mhpmevent_va
 		*mhpmevent_val |= MHPMEVENT_SINH;
 }
 
-static int pmu_update_hw_mhpmevent(struct sbi_pmu_hw_event *hw_evt, int ctr_idx,
-				   unsigned long flags, unsigned long eindex,
-				   uint64_t data)
+static int pmu_update_hw_mhpmevent(int ctr_idx, unsigned long flags,
+				   unsigned long eindex, uint64_t data)
 {
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 	const struct sbi_platform *plat = sbi_platform_ptr(scratch);
@@ -570,12 +776,22 @@ int sbi_pmu_ctr_start(unsigned long cbase, unsigned long cmask,
 	bool bUpdate = false;
 	int i, cidx;
 	uint64_t edata;
+	struct sbi_pmu_snapshot *sdata = NULL;
 
 	if (!pmu_ctr_idx_validate(cbase, cmask))
 		return ret;
 
-	if (flags & SBI_PMU_STOP_FLAG_TAKE_SNAPSHOT)
-		return SBI_ENO_SHMEM;
+	if (flags & SBI_PMU_START_FLAG_INIT_FROM_SNAPSHOT) {
+		if (phs->snapshot_shmem == PMU_SNAPSHOT_SHMEM_INVALID)
+			return SBI_ENO_SHMEM;
+		/* An explicit initial value takes precedence */
+		if (!(flags & SBI_PMU_START_FLAG_SET_INIT_VALUE)) {
+			sdata = (struct sbi_pmu_snapshot *)phs->snapshot_shmem;
+			sbi_hart_protection_map_range(phs->snapshot_shmem,
+						      SBI_PMU_SNAPSHOT_SHMEM_SIZE);
+		}
+		bUpdate = true;
+	}
 
 	if (flags & SBI_PMU_START_FLAG_SET_INIT_VALUE)
 		bUpdate = true;
@@ -586,7 +802,9 @@ int sbi_pmu_ctr_start(unsigned long cbase, unsigned long cmask,
 		if (event_idx_type < 0)
 			/* Continue the start operation for other counters */
 			continue;
-		else if (event_idx_type == SBI_PMU_EVENT_TYPE_FW) {
+		if (sdata)
+			ival = sdata->ctr_values[i];
+		if (event_idx_type == SBI_PMU_EVENT_TYPE_FW) {
 			edata = (event_code == SBI_PMU_FW_PLATFORM) ?
 				 phs->fw_counters_data[cidx - num_hw_ctrs]
 				 : 0x0;
@@ -597,17 +815,20 @@ int sbi_pmu_ctr_start(unsigned long cbase, unsigned long cmask,
 				struct sbi_pmu_hw_event_config *ev_cfg =
 					&phs->hw_counters_cfg[cidx];
 
-				ret = pmu_update_hw_mhpmevent(&hw_event_map[cidx], cidx,
-							ev_cfg->flags,
+				ret = pmu_update_hw_mhpmevent(cidx, ev_cfg->flags,
 							phs->active_events[cidx],
 							ev_cfg->event_data);
 				if (ret)
-					return ret;
+					break;
 			}
 			ret = pmu_ctr_start_hw(cidx, ival, bUpdate);
 		}
 	}
 
+	if (sdata)
+		sbi_hart_protection_unmap_range(phs->snapshot_shmem,
+						SBI_PMU_SNAPSHOT_SHMEM_SIZE);
+
 	return ret;
 }
 
@@ -649,8 +870,8 @@ static int pmu_ctr_stop_fw(struct sbi_pmu_hart_state *phs,
 	if (!(phs->fw_counters_started & BIT(cidx - num_hw_ctrs)))
 		return SBI_EALREADY_STOPPED;
 
-	if (SBI_PMU_FW_PLATFORM == event_code &&
-	    pmu_dev && pmu_dev->fw_counter_stop) {
+	if (SBI_PMU_FW_PLATFORM == event_code && !pmu_fw_internal_events() &&
+	    pmu_dev->fw_counter_stop) {
 		ret = pmu_dev->fw_counter_stop(phs->hartid, cidx - num_hw_ctrs);
 		if (ret)
 			return ret;
@@ -689,12 +910,20 @@ int sbi_pmu_ctr_stop(unsigned long cbase, unsigned long cmask,
 	int event_idx_type;
 	uint32_t event_code;
 	int i, cidx;
+	struct sbi_pmu_snapshot *sdata = NULL;
+	uint64_t ovf_mask = 0;
 
 	if (!pmu_ctr_idx_validate(cbase, cmask))
 		return ret;
 
-	if (flag & SBI_PMU_STOP_FLAG_TAKE_SNAPSHOT)
-		return SBI_ENO_SHMEM;
+	if (flag & SBI_PMU_STOP_FLAG_TAKE_SNAPSHOT) {
+		if (phs->snapshot_shmem == PMU_SNAPSHOT_SHMEM_INVALID)
+			return SBI_ENO_SHMEM;
+		sdata = (struct sbi_pmu_snapshot *)phs->snapshot_shmem;
+		sbi_hart_protection_map_range(phs->snapshot_shmem,
+					      SBI_PMU_SNAPSHOT_SHMEM_SIZE);
+		ovf_mask = sdata->ctr_overflow_mask;
+	}
 
 	for_each_set_bit(i, &cmask, BITS_PER_LONG) {
 		cidx = i + cbase;
@@ -708,12 +937,40 @@ int sbi_pmu_ctr_stop(unsigned long cbase, unsigned long cmask,
 		else
 			ret = pmu_ctr_stop_hw(cidx);
 
+		/* The overflow bit is lost on reset so sample it first */
+		if (sdata) {
+			if (event_idx_type == SBI_PMU_EVENT_TYPE_FW)
+				sdata->ctr_values[i] =
+					pmu_ctr_read_fw(phs, cidx, event_code);
+			else
+				sdata->ctr_values[i] = pmu_ctr_read_hw(cidx);
+
+			if (pmu_ctr_hw_overflown(cidx))
+				ovf_mask |= BIT_ULL(i);
+			else
+				ovf_mask &= ~BIT_ULL(i);
+		}
+
 		if (cidx > (CSR_INSTRET - CSR_CYCLE) && flag & SBI_PMU_STOP_FLAG_RESET) {
+			if (event_idx_type == SBI_PMU_EVENT_TYPE_FW) {
+				if (event_code < SBI_PMU_FW_MAX)
+					phs->fw_event_counters[event_code] &=
+						~BIT(cidx - num_hw_ctrs);
+				phs->fw_counters_used &= ~BIT(cidx - num_hw_ctrs);
+			} else if (cidx < num_hw_ctrs) {
+				phs->hw_counters_used &= ~BIT(cidx);
+			}
 			phs->active_events[cidx] = SBI_PMU_EVENT_IDX_INVALID;
 			pmu_reset_hw_mhpmevent(cidx);
 		}
 	}
 
+	if (sdata) {
+		sdata->ctr_overflow_mask = ovf_mask;
+		sbi_hart_protection_unmap_range(phs->snapshot_shmem,
+						SBI_PMU_SNAPSHOT_SHMEM_SIZE);
+	}
+
 	/* Clear PMU overflow interrupt to avoid spurious ones */
 	if (phs->sse_enabled)
 		csr_clear(CSR_MIP, sbi_pmu_irq_mask());
@@ -781,9 +1038,7 @@ static int pmu_ctr_find_hw(struct sbi_pmu_hart_state *phs,
 			   unsigned long event_idx, uint64_t data)
 {
 	unsigned long ctr_mask;
-	int i, ret = 0, fixed_ctr, ctr_idx = SBI_ENOTSUPP;
-	struct sbi_pmu_hw_event *temp;
-	unsigned long mctr_inhbt = 0;
+	int ret = 0, fixed_ctr, ctr_idx;
 	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 
 	if (cbase >= num_hw_ctrs)
@@ -799,44 +1054,18 @@ static int pmu_ctr_find_hw(struct sbi_pmu_hart_state *phs,
 	    !sbi_hart_has_extension(scratch, SBI_HART_EXT_XANDESPMU))
 		return pmu_fixed_ctr_update_inhibit_bits(fixed_ctr, flags);
 
+	/* Fixed counters should not be part of the search */
+	ctr_mask = pmu_hw_event_counters(event_idx, data) & (cmask << cbase) &
+		   ~(SBI_PMU_FIXED_CTR_MASK | phs->hw_counters_used);
+	/**
+	 * Some of the platform may not support mcountinhibit.
+	 * Checking the used counters is enough for them. Otherwise,
+	 * the counter must not be started yet.
+	 */
 	if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11)
-		mctr_inhbt = csr_read(CSR_MCOUNTINHIBIT);
-	for (i = 0; i < num_hw_events; i++) {
-		temp = &hw_event_map[i];
-		if ((temp->start_idx > event_idx && event_idx < temp->end_idx) ||
-		    (temp->start_idx < event_idx && event_idx > temp->end_idx))
-			continue;
-
-		/* For raw events, event data is used as the select value */
-		if (event_idx == SBI_PMU_EVENT_RAW_IDX ||
-			event_idx == SBI_PMU_EVENT_RAW_V2_IDX) {
-			uint64_t select_mask = temp->select_mask;
+		ctr_mask &= csr_read(CSR_MCOUNTINHIBIT);
 
-			/* The non-event map bits of data should match the selector */
-			if (temp->select != (data & select_mask))
-				continue;
-		}
-		/* Fixed counters should not be part of the search */
-		ctr_mask = temp->counters & (cmask << cbase) &
-			   (~SBI_PMU_FIXED_CTR_MASK);
-		for_each_set_bit_from(cbase, &ctr_mask, SBI_PMU_HW_CTR_MAX) {
-			/**
-			 * Some of the platform may not support mcountinhibit.
-			 * Checking the active_events is enough for them
-			 */
-			if (phs->active_events[cbase] != SBI_PMU_EVENT_IDX_INVALID)
-				continue;
-			/* If mcountinhibit is supported, the bit must be enabled */
-			if ((sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11) &&
-			    !__test_bit(cbase, &mctr_inhbt))
-				continue;
-			/* We found a valid counter that is not started yet */
-			ctr_idx = cbase;
-			break;
-		}
-	}
-
-	if (ctr_idx == SBI_ENOTSUPP) {
+	if (!ctr_mask) {
 		/**
 		 * We can't find a programmable counter, see if we can use a
 		 * fixed counter instead if one was found for this event.
@@ -853,7 +1082,9 @@ static int pmu_ctr_find_hw(struct sbi_pmu_hart_state *phs,
 
 		return pmu_fixed_ctr_update_inhibit_bits(fixed_ctr, flags);
 	}
-	ret = pmu_update_hw_mhpmevent(temp, ctr_idx, flags, event_idx, data);
+
+	ctr_idx = sbi_ffs(ctr_mask);
+	ret = pmu_update_hw_mhpmevent(ctr_idx, flags, event_idx, data);
 
 	if (!ret)
 		ret = ctr_idx;
@@ -880,7 +1111,8 @@ static int pmu_ctr_find_fw(struct sbi_pmu_hart_state *phs,
 		if (phs->active_events[cidx] != SBI_PMU_EVENT_IDX_INVALID)
 			continue;
 		if (SBI_PMU_FW_PLATFORM == event_code &&
-		    pmu_dev && pmu_dev->fw_counter_match_encoding) {
+		    !pmu_fw_internal_events() &&
+		    pmu_dev->fw_counter_match_encoding) {
 			if (!pmu_dev->fw_counter_match_encoding(phs->hartid,
 							    cidx - num_hw_ctrs,
 							    edata))
@@ -936,9 +1168,17 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 		/* Any firmware counter can be used track any firmware event */
 		ctr_idx = pmu_ctr_find_fw(phs, cidx_base, cidx_mask,
 					  event_code, event_data);
-		if ((event_code == SBI_PMU_FW_PLATFORM) && (ctr_idx >= num_hw_ctrs))
-			phs->fw_counters_data[ctr_idx - num_hw_ctrs] =
+		if (ctr_idx >= 0 && event_code == SBI_PMU_FW_PLATFORM) {
+			if (pmu_fw_internal_events())
+				phs->fw_internal_data[ctr_idx - num_hw_ctrs] =
+								event_data;
+			else
+				phs->fw_counters_data[ctr_idx - num_hw_ctrs] =
 								event_data;
+		} else if (ctr_idx >= 0) {
+			phs->fw_event_counters[event_code] |=
+						BIT(ctr_idx - num_hw_ctrs);
+		}
 	} else {
 		ctr_idx = pmu_ctr_find_hw(phs, cidx_base, cidx_mask, flags,
 					  event_idx, event_data);
@@ -956,6 +1196,10 @@ int sbi_pmu_ctr_cfg_match(unsigned long cidx_base, unsigned long cidx_mask,
 		return SBI_ENOTSUPP;
 
 	phs->active_events[ctr_idx] = event_idx;
+	if (ctr_idx < num_hw_ctrs)
+		phs->hw_counters_used |= BIT(ctr_idx);
+	else
+		phs->fw_counters_used |= BIT(ctr_idx - num_hw_ctrs);
 skip_match:
 	if (event_type == SBI_PMU_EVENT_TYPE_HW ||
 	    event_type == SBI_PMU_EVENT_TYPE_HW_CACHE ||
@@ -970,7 +1214,8 @@ skip_match:
 			phs->fw_counters_data[ctr_idx - num_hw_ctrs] = 0;
 		if (flags & SBI_PMU_CFG_FLAG_AUTO_START) {
 			if (SBI_PMU_FW_PLATFORM == event_code &&
-			    pmu_dev && pmu_dev->fw_counter_start) {
+			    !pmu_fw_internal_events() &&
+			    pmu_dev->fw_counter_start) {
 				ret = pmu_dev->fw_counter_start(
 					phs->hartid,
 					ctr_idx - num_hw_ctrs, event_data);
@@ -986,8 +1231,7 @@ skip_match:
 
 int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id)
 {
-	u32 cidx;
-	uint64_t *fcounter = NULL;
+	unsigned long ctrs;
 	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 
 	if (unlikely(!phs))
@@ -999,17 +1243,42 @@ int sbi_pmu_ctr_incr_fw(enum sbi_pmu_fw_event_code_id fw_id)
 	if (unlikely(fw_id >= SBI_PMU_FW_MAX))
 		return SBI_EINVAL;
 
+	/* Only the first started counter of the event is incremented */
+	ctrs = phs->fw_event_counters[fw_id] & phs->fw_counters_started;
+	if (ctrs)
+		phs->fw_counters_data[sbi_ffs(ctrs)]++;
+
+	return 0;
+}
+
+int sbi_pmu_ctr_add_fw_internal(uint64_t event_data, uint64_t value)
+{
+	u32 cidx;
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (unlikely(!phs))
+		return 0;
+
+	if (likely(!phs->fw_counters_started))
+		return 0;
+
+	if (unlikely(SBI_PMU_FW_INTERNAL_ID(event_data) >=
+						SBI_PMU_FW_INTERNAL_MAX))
+		return SBI_EINVAL;
+
+	if (!pmu_fw_internal_events())
+		return 0;
+
 	for (cidx = num_hw_ctrs; cidx < total_ctrs; cidx++) {
-		if (get_cidx_code(phs->active_events[cidx]) == fw_id &&
+		if (get_cidx_code(phs->active_events[cidx]) ==
+						SBI_PMU_FW_PLATFORM &&
+		    phs->fw_internal_data[cidx - num_hw_ctrs] == event_data &&
 		    (phs->fw_counters_started & BIT(cidx - num_hw_ctrs))) {
-			fcounter = &phs->fw_counters_data[cidx - num_hw_ctrs];
+			phs->fw_counters_data[cidx - num_hw_ctrs] += value;
 			break;
 		}
 	}
 
-	if (fcounter)
-		(*fcounter)++;
-
 	return 0;
 }
 
@@ -1062,12 +1331,10 @@ int sbi_pmu_event_get_info(unsigned long shmem_phys_lo, unsigned long shmem_phys
 			   unsigned long num_events, unsigned long flags)
 {
 	unsigned long shmem_size = num_events * sizeof(struct sbi_pmu_event_info);
-	int i, j, event_type;
+	int i, event_type;
 	struct sbi_pmu_event_info *einfo;
 	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
 	uint32_t event_idx;
-	struct sbi_pmu_hw_event *temp;
-	bool found = false;
 
 	if (flags != 0)
 		return SBI_ERR_INVALID_PARAM;
@@ -1102,28 +1369,8 @@ int sbi_pmu_event_get_info(unsigned long shmem_phys_lo, unsigned long shmem_phys
 		if (event_type < 0) {
 			einfo[i].output = 0;
 		} else {
-			for (j = 0; j < num_hw_events; j++) {
-				temp = &hw_event_map[j];
-				/* For raw events, event data is used as the select value */
-				if (event_idx == SBI_PMU_EVENT_RAW_IDX ||
-					event_idx == SBI_PMU_EVENT_RAW_V2_IDX) {
-					/* just match the selector */
-					if (temp->select == (einfo[i].event_data &
-									temp->select_mask)) {
-						found = true;
-						break;
-					}
-				} else if (temp->start_idx <= event_idx &&
-					   event_idx <= temp->end_idx) {
-					found = true;
-					break;
-				}
-			}
-			if (found)
-				einfo[i].output = 1;
-			else
-				einfo[i].output = 0;
-			found = false;
+			einfo[i].output = pmu_hw_event_counters(event_idx,
+						einfo[i].event_data) ? 1 : 0;
 		}
 	}
 
@@ -1132,6 +1379,43 @@ int sbi_pmu_event_get_info(unsigned long shmem_phys_lo, unsigned long shmem_phys
 	return 0;
 }
 
+int sbi_pmu_snapshot_set_shmem(unsigned long shmem_phys_lo,
+			       unsigned long shmem_phys_hi,
+			       unsigned long flags)
+{
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+
+	if (unlikely(!phs))
+		return SBI_EFAIL;
+
+	if (flags != 0)
+		return SBI_EINVAL;
+
+	/* All-ones address disables the snapshot shared memory */
+	if (shmem_phys_lo == PMU_SNAPSHOT_SHMEM_INVALID &&
+	    shmem_phys_hi == PMU_SNAPSHOT_SHMEM_INVALID) {
+		phs->snapshot_shmem = PMU_SNAPSHOT_SHMEM_INVALID;
+		return 0;
+	}
+
+	if (shmem_phys_lo & SBI_PMU_SNAPSHOT_SHMEM_ALIGN_MASK)
+		return SBI_EINVAL;
+
+	/* M-mode can only access the lower part of the address space */
+	if (shmem_phys_hi)
+		return SBI_EINVALID_ADDR;
+
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
+					 shmem_phys_lo,
+					 SBI_PMU_SNAPSHOT_SHMEM_SIZE, PRV_S,
+					 SBI_DOMAIN_READ | SBI_DOMAIN_WRITE))
+		return SBI_EINVALID_ADDR;
+
+	phs->snapshot_shmem = shmem_phys_lo;
+
+	return 0;
+}
+
 static void pmu_reset_event_map(struct sbi_pmu_hart_state *phs)
 {
 	int j;
@@ -1139,10 +1423,163 @@ static void pmu_reset_event_map(struct sbi_pmu_hart_state *phs)
 	/* Initialize the counter to event mapping table */
 	for (j = 3; j < total_ctrs; j++)
 		phs->active_events[j] = SBI_PMU_EVENT_IDX_INVALID;
-	for (j = 0; j < SBI_PMU_FW_CTR_MAX; j++)
+	for (j = 0; j < SBI_PMU_FW_CTR_MAX; j++) {
 		phs->fw_counters_data[j] = 0;
+		phs->fw_internal_data[j] = 0;
+	}
+	for (j = 0; j < SBI_PMU_FW_MAX; j++)
+		phs->fw_event_counters[j] = 0;
+	phs->hw_counters_used = 0;
+	phs->fw_counters_used = 0;
 	phs->fw_counters_started = 0;
 	phs->sse_enabled = 0;
+	phs->snapshot_shmem = PMU_SNAPSHOT_SHMEM_INVALID;
+}
+
+/** PMU state of a HART saved in a domain context */
+struct sbi_pmu_context {
+	/* True if the state below holds counters of the domain */
+	bool in_use;
+	/* Multiplexed event set of the domain */
+	struct sbi_pmu_mux_context mux;
+	/* Counter configuration of the domain */
+	struct sbi_pmu_hart_state phs;
+	/* Bitmap of hardware counters which were counting */
+	unsigned long hw_counters_running;
+	/* Values and mhpmevent CSRs of the hardware counters */
+	uint64_t hw_counters_val[SBI_PMU_HW_CTR_MAX];
+	uint64_t hw_counters_event[SBI_PMU_HW_CTR_MAX];
+};
+
+static inline bool pmu_hart_state_in_use(struct sbi_pmu_hart_state *phs)
+{
+	/* Fixed counters are shared by all domains */
+	return (phs->hw_counters_used & ~SBI_PMU_FIXED_CTR_MASK) ||
+	       phs->fw_counters_used ||
+	       phs->snapshot_shmem != PMU_SNAPSHOT_SHMEM_INVALID;
+}
+
+static void pmu_context_save(struct sbi_pmu_hart_state *phs,
+			     struct sbi_pmu_context *ctx)
+{
+	bool sse_enabled = phs->sse_enabled;
+	unsigned long used;
+	int cidx;
+
+	ctx->hw_counters_running = 0;
+	used = phs->hw_counters_used & ~SBI_PMU_FIXED_CTR_MASK;
+	for_each_set_bit(cidx, &used, SBI_PMU_HW_CTR_MAX) {
+		if (!pmu_ctr_stop_hw(cidx))
+			ctx->hw_counters_running |= BIT(cidx);
+		ctx->hw_counters_val[cidx] = pmu_ctr_read_hw(cidx);
+		/* Don't leave the count readable by the next domain */
+		pmu_ctr_write_hw(cidx, 0);
+#if __riscv_xlen == 32
+		ctx->hw_counters_event[cidx] =
+			csr_read_num(CSR_MHPMEVENT3 + cidx - 3);
+		if (sbi_hart_has_extension(sbi_scratch_thishart_ptr(),
+					   SBI_HART_EXT_SSCOFPMF))
+			ctx->hw_counters_event[cidx] |= (uint64_t)
+				csr_read_num(CSR_MHPMEVENT3H + cidx - 3) << 32;
+#else
+		ctx->hw_counters_event[cidx] =
+			csr_read_num(CSR_MHPMEVENT3 + cidx - 3);
+#endif
+		pmu_reset_hw_mhpmevent(cidx);
+	}
+
+	sbi_memcpy(&ctx->phs, phs, sizeof(*phs));
+	pmu_reset_event_map(phs);
+	phs->sse_enabled = sse_enabled;
+}
+
+static void pmu_context_restore(struct sbi_pmu_hart_state *phs,
+				struct sbi_pmu_context *ctx)
+{
+	bool sse_enabled = phs->sse_enabled;
+	unsigned long used;
+	int cidx;
+
+	sbi_memcpy(phs, &ctx->phs, sizeof(*phs));
+	phs->sse_enabled = sse_enabled;
+
+	used = phs->hw_counters_used & ~SBI_PMU_FIXED_CTR_MASK;
+	for_each_set_bit(cidx, &used, SBI_PMU_HW_CTR_MAX) {
+#if __riscv_xlen == 32
+		csr_write_num(CSR_MHPMEVENT3 + cidx - 3,
+			      ctx->hw_counters_event[cidx] & 0xFFFFFFFF);
+		if (sbi_hart_has_extension(sbi_scratch_thishart_ptr(),
+					   SBI_HART_EXT_SSCOFPMF))
+			csr_write_num(CSR_MHPMEVENT3H + cidx - 3,
+				      ctx->hw_counters_event[cidx] >> 32);
+#else
+		csr_write_num(CSR_MHPMEVENT3 + cidx - 3,
+			      ctx->hw_counters_event[cidx]);
+#endif
+		if (ctx->hw_counters_running & BIT(cidx))
+			pmu_ctr_start_hw(cidx, ctx->hw_counters_val[cidx], true);
+		else
+			pmu_ctr_write_hw(cidx, ctx->hw_counters_val[cidx]);
+	}
+}
+
+/* Reset the PMU state of a domain which could not be saved */
+static void pmu_context_drop(struct sbi_pmu_hart_state *phs)
+{
+	bool sse_enabled = phs->sse_enabled;
+	unsigned long used;
+	int cidx;
+
+	used = phs->hw_counters_used & ~SBI_PMU_FIXED_CTR_MASK;
+	for_each_set_bit(cidx, &used, SBI_PMU_HW_CTR_MAX) {
+		pmu_ctr_stop_hw(cidx);
+		pmu_ctr_write_hw(cidx, 0);
+		pmu_reset_hw_mhpmevent(cidx);
+	}
+
+	pmu_reset_event_map(phs);
+	phs->sse_enabled = sse_enabled;
+}
+
+void sbi_pmu_context_switch(struct sbi_pmu_context **save,
+			    struct sbi_pmu_context *restore)
+{
+	struct sbi_pmu_hart_state *phs = pmu_thishart_state_ptr();
+	struct sbi_pmu_mux_context mux = { 0 };
+	struct sbi_pmu_context *ctx;
+	bool in_use;
+
+	if (unlikely(!phs) || !save)
+		return;
+
+	/* The multiplexed event set gives its counters back first */
+	sbi_pmu_mux_context_save(&mux);
+	in_use = pmu_hart_state_in_use(phs);
+
+	/* Only domains which used the PMU get a context allocated */
+	ctx = *save;
+	if (!ctx && (in_use || mux.registered)) {
+		ctx = *save = sbi_zalloc(sizeof(*ctx));
+		if (!ctx) {
+			sbi_printf("%s: no memory, PMU state dropped\n",
+				   __func__);
+			pmu_context_drop(phs);
+		}
+	}
+
+	if (ctx) {
+		ctx->mux = mux;
+		ctx->in_use = in_use;
+		if (in_use)
+			pmu_context_save(phs, ctx);
+	}
+
+	if (!restore)
+		return;
+
+	if (restore->in_use)
+		pmu_context_restore(phs, restore);
+	sbi_pmu_mux_context_restore(&restore->mux);
 }
 
 const struct sbi_pmu_device *sbi_pmu_get_device(void)
@@ -1162,6 +1599,8 @@ void sbi_pmu_exit(struct sbi_scratch *scratch)
 {
 	struct sbi_pmu_hart_state *phs = pmu_get_hart_state_ptr(scratch);
 
+	sbi_pmu_mux_exit(scratch);
+
 	if (sbi_hart_priv_version(scratch) >= SBI_HART_PRIV_VER_1_11)
 		csr_write(CSR_MCOUNTINHIBIT, 0xFFFFFFF8);
 
@@ -1231,8 +1670,19 @@ int sbi_pmu_init(struct sbi_scratch *scratch, bool cold_boot)
 		if (!hw_event_map)
 			return SBI_ENOMEM;
 
+		hw_range_index = sbi_calloc(sizeof(*hw_range_index),
+					    2 * SBI_PMU_HW_EVENT_MAX +
+					    PMU_RAW_HASH_SLOTS);
+		if (!hw_range_index) {
+			sbi_free(hw_event_map);
+			return SBI_ENOMEM;
+		}
+		hw_raw_masks = &hw_range_index[SBI_PMU_HW_EVENT_MAX];
+		hw_raw_hash = &hw_raw_masks[SBI_PMU_HW_EVENT_MAX];
+
 		phs_ptr_offset = sbi_scratch_alloc_type_offset(void *);
 		if (!phs_ptr_offset) {
+			sbi_free(hw_range_index);
 			sbi_free(hw_event_map);
 			return SBI_ENOMEM;
 		}
@@ -1278,5 +1728,5 @@ int sbi_pmu_init(struct sbi_scratch *scratch, bool cold_boot)
 	phs->active_events[2] = (SBI_PMU_EVENT_TYPE_HW << SBI_PMU_EVENT_IDX_TYPE_OFFSET) |
 				SBI_PMU_HW_INSTRUCTIONS;
 
-	return 0;
+	return sbi_pmu_mux_init(scratch, cold_boot);
 }
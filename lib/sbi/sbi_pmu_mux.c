@@ -0,0 +1,366 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/riscv_asm.h>
+#include <sbi/sbi_bitops.h>
+#include <sbi/sbi_domain.h>
+#include <sbi/sbi_ecall_interface.h>
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_hart_protection.h>
+#include <sbi/sbi_heap.h>
+#include <sbi/sbi_pmu.h>
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_timer.h>
+
+/* Multiplexed event set is not registered */
+#define PMU_MUX_SHMEM_INVALID	(-1UL)
+
+/** Per-HART state of the multiplexed event set */
+struct pmu_mux_state {
+	/* Timer event rotating the event set */
+	struct sbi_timer_event event;
+	/* Event set shared memory address or PMU_MUX_SHMEM_INVALID */
+	unsigned long shmem;
+	/* Number of entries in the event set */
+	u32 num_events;
+	/* Hardware counters the event set may be rotated over */
+	unsigned long cmask;
+	/* Rotation period in timer ticks */
+	u64 period;
+	/* True while the event set is rotated */
+	bool running;
+	/* Next event set entry to be scheduled */
+	u32 next;
+	/* Time stamp at which the scheduled entries were started */
+	u64 slot_start;
+	/* Number of scheduled entries */
+	u32 num_active;
+	/* Scheduled entries and the counters they were given */
+	u8 active_event[SBI_PMU_HW_CTR_MAX];
+	u8 active_ctr[SBI_PMU_HW_CTR_MAX];
+};
+
+static unsigned long pmu_mux_off;
+
+static inline struct pmu_mux_state *pmu_mux_thishart_ptr(void)
+{
+	if (!pmu_mux_off)
+		return NULL;
+
+	return sbi_scratch_read_type(sbi_scratch_thishart_ptr(),
+				     struct pmu_mux_state *, pmu_mux_off);
+}
+
+static inline unsigned long pmu_mux_shmem_size(struct pmu_mux_state *ms)
+{
+	return ms->num_events * sizeof(struct sbi_pmu_mux_event);
+}
+
+static bool pmu_mux_event_valid(const struct sbi_pmu_mux_event *mev)
+{
+	u32 type = (mev->event_idx & SBI_PMU_EVENT_IDX_TYPE_MASK) >>
+		   SBI_PMU_EVENT_IDX_TYPE_OFFSET;
+	u32 code = mev->event_idx & SBI_PMU_EVENT_IDX_CODE_MASK;
+
+	/* Firmware events are never short of counters */
+	if (type == SBI_PMU_EVENT_TYPE_FW)
+		return false;
+
+	/* Fixed counters always count cycles and instructions */
+	return !(type == SBI_PMU_EVENT_TYPE_HW &&
+		 (code == SBI_PMU_HW_CPU_CYCLES ||
+		  code == SBI_PMU_HW_INSTRUCTIONS));
+}
+
+/* Accumulate and release the counters of the scheduled entries */
+static void pmu_mux_flush(struct pmu_mux_state *ms,
+			  struct sbi_pmu_mux_event *set, u64 now)
+{
+	struct sbi_pmu_mux_event *mev;
+	uint64_t val;
+	u32 i, cidx;
+
+	for (i = 0; i < ms->num_active; i++) {
+		cidx = ms->active_ctr[i];
+		mev = &set[ms->active_event[i]];
+
+		sbi_pmu_ctr_stop(cidx, 1, 0);
+		if (!sbi_pmu_ctr_read(cidx, &val)) {
+			mev->value += val;
+			mev->time_running += now - ms->slot_start;
+		}
+		sbi_pmu_ctr_stop(cidx, 1, SBI_PMU_STOP_FLAG_RESET);
+	}
+
+	ms->num_active = 0;
+}
+
+/* Give the free counters to the next entries in round-robin order */
+static void pmu_mux_schedule(struct pmu_mux_state *ms,
+			     struct sbi_pmu_mux_event *set, u64 now)
+{
+	struct sbi_pmu_mux_event *mev;
+	u32 tried, max = sbi_popcount(ms->cmask);
+	int cidx;
+
+	for (tried = 0; tried < ms->num_events && ms->num_active < max;
+	     tried++) {
+		mev = &set[ms->next];
+		if (pmu_mux_event_valid(mev)) {
+			cidx = sbi_pmu_ctr_cfg_match(0, ms->cmask,
+					(mev->cfg_flags & SBI_PMU_CFG_EVENT_MASK) |
+					SBI_PMU_CFG_FLAG_CLEAR_VALUE |
+					SBI_PMU_CFG_FLAG_AUTO_START,
+					mev->event_idx, mev->event_data);
+			if (cidx >= 0) {
+				ms->active_event[ms->num_active] = ms->next;
+				ms->active_ctr[ms->num_active] = cidx;
+				ms->num_active++;
+			}
+		}
+		ms->next = (ms->next + 1) % ms->num_events;
+	}
+
+	ms->slot_start = now;
+}
+
+static void pmu_mux_rotate(struct pmu_mux_state *ms, bool reschedule)
+{
+	struct sbi_pmu_mux_event *set = (struct sbi_pmu_mux_event *)ms->shmem;
+	u64 now = sbi_timer_value();
+
+	sbi_hart_protection_map_range(ms->shmem, pmu_mux_shmem_size(ms));
+	pmu_mux_flush(ms, set, now);
+	if (reschedule)
+		pmu_mux_schedule(ms, set, now);
+	sbi_hart_protection_unmap_range(ms->shmem, pmu_mux_shmem_size(ms));
+}
+
+/* Schedule the first entries and start rotating the event set */
+static void pmu_mux_run(struct pmu_mux_state *ms)
+{
+	ms->running = true;
+	pmu_mux_rotate(ms, true);
+	sbi_timer_event_start(&ms->event, ms->slot_start + ms->period);
+}
+
+/* Stop rotating the event set and accumulate the scheduled entries */
+static void pmu_mux_halt(struct pmu_mux_state *ms)
+{
+	sbi_timer_event_stop(&ms->event);
+	ms->running = false;
+	pmu_mux_rotate(ms, false);
+}
+
+static void pmu_mux_register(struct pmu_mux_state *ms, unsigned long shmem,
+			     unsigned long num_events, unsigned long cmask,
+			     u64 period)
+{
+	ms->shmem = shmem;
+	ms->num_events = num_events;
+	ms->cmask = cmask;
+	ms->period = period;
+	ms->next = 0;
+
+	/*
+	 * Counts are scaled by the measured running time, so rotating
+	 * a little late is fine and lets the rotation share a timer
+	 * interrupt with other events.
+	 */
+	ms->event.slack = period / 8;
+}
+
+static void pmu_mux_event_callback(struct sbi_timer_event *ev,
+				   struct sbi_timer_event_restart *restart)
+{
+	struct pmu_mux_state *ms = ev->priv;
+
+	if (!ms->running)
+		return;
+
+	pmu_mux_rotate(ms, true);
+
+	restart->required = true;
+	restart->next_event = ms->slot_start + ms->period;
+}
+
+static void pmu_mux_event_cleanup(struct sbi_timer_event *ev)
+{
+	struct pmu_mux_state *ms = ev->priv;
+
+	ms->running = false;
+	ms->num_active = 0;
+}
+
+int sbi_pmu_mux_set_shmem(unsigned long shmem_phys_lo,
+			  unsigned long shmem_phys_hi,
+			  unsigned long num_events, unsigned long cmask,
+			  unsigned long period_us)
+{
+	struct pmu_mux_state *ms = pmu_mux_thishart_ptr();
+	struct sbi_pmu_mux_event *set;
+	unsigned long i, size, num_hw_ctrs;
+
+	if (!ms)
+		return SBI_EFAIL;
+
+	if (ms->running)
+		return SBI_EALREADY_STARTED;
+
+	/* All-ones address unregisters the event set */
+	if (shmem_phys_lo == PMU_MUX_SHMEM_INVALID &&
+	    shmem_phys_hi == PMU_MUX_SHMEM_INVALID) {
+		ms->shmem = PMU_MUX_SHMEM_INVALID;
+		return 0;
+	}
+
+	/* Only programmable hardware counters are rotated */
+	num_hw_ctrs = sbi_pmu_num_ctr() - SBI_PMU_FW_CTR_MAX;
+	if (num_hw_ctrs < BITS_PER_LONG)
+		cmask &= BIT(num_hw_ctrs) - 1;
+	cmask &= ~(unsigned long)SBI_PMU_FIXED_CTR_MASK;
+
+	if (!num_events || num_events > SBI_PMU_MUX_MAX_EVENTS || !cmask ||
+	    period_us < SBI_PMU_MUX_MIN_PERIOD_US ||
+	    (shmem_phys_lo & (sizeof(uint64_t) - 1)))
+		return SBI_EINVAL;
+
+	/* M-mode can only access the lower part of the address space */
+	if (shmem_phys_hi)
+		return SBI_EINVALID_ADDR;
+
+	size = num_events * sizeof(*set);
+	if (!sbi_domain_check_addr_range(sbi_domain_thishart_ptr(),
+					 shmem_phys_lo, size, PRV_S,
+					 SBI_DOMAIN_READ | SBI_DOMAIN_WRITE))
+		return SBI_EINVALID_ADDR;
+
+	set = (struct sbi_pmu_mux_event *)shmem_phys_lo;
+	sbi_hart_protection_map_range(shmem_phys_lo, size);
+	for (i = 0; i < num_events; i++) {
+		if (!pmu_mux_event_valid(&set[i]))
+			break;
+	}
+	sbi_hart_protection_unmap_range(shmem_phys_lo, size);
+	if (i < num_events)
+		return SBI_EINVAL;
+
+	pmu_mux_register(ms, shmem_phys_lo, num_events, cmask,
+			 sbi_timer_compute_udelta(period_us));
+
+	return 0;
+}
+
+int sbi_pmu_mux_start(void)
+{
+	struct pmu_mux_state *ms = pmu_mux_thishart_ptr();
+
+	if (!ms || ms->shmem == PMU_MUX_SHMEM_INVALID)
+		return SBI_ENO_SHMEM;
+
+	if (ms->running)
+		return SBI_EALREADY_STARTED;
+
+	pmu_mux_run(ms);
+
+	return 0;
+}
+
+int sbi_pmu_mux_stop(void)
+{
+	struct pmu_mux_state *ms = pmu_mux_thishart_ptr();
+
+	if (!ms || ms->shmem == PMU_MUX_SHMEM_INVALID)
+		return SBI_ENO_SHMEM;
+
+	if (!ms->running)
+		return SBI_EALREADY_STOPPED;
+
+	pmu_mux_halt(ms);
+
+	return 0;
+}
+
+void sbi_pmu_mux_exit(struct sbi_scratch *scratch)
+{
+	struct pmu_mux_state *ms;
+
+	if (!pmu_mux_off)
+		return;
+
+	ms = sbi_scratch_read_type(scratch, struct pmu_mux_state *,
+				   pmu_mux_off);
+	if (!ms)
+		return;
+
+	if (ms->running)
+		pmu_mux_halt(ms);
+	ms->shmem = PMU_MUX_SHMEM_INVALID;
+}
+
+void sbi_pmu_mux_context_save(struct sbi_pmu_mux_context *ctx)
+{
+	struct pmu_mux_state *ms = pmu_mux_thishart_ptr();
+
+	ctx->registered = ms && ms->shmem != PMU_MUX_SHMEM_INVALID;
+	if (!ctx->registered)
+		return;
+
+	/* The scheduled counters must be released before they are saved */
+	ctx->running = ms->running;
+	if (ms->running)
+		pmu_mux_halt(ms);
+
+	ctx->shmem = ms->shmem;
+	ctx->num_events = ms->num_events;
+	ctx->cmask = ms->cmask;
+	ctx->period = ms->period;
+	ctx->next = ms->next;
+	ms->shmem = PMU_MUX_SHMEM_INVALID;
+}
+
+void sbi_pmu_mux_context_restore(const struct sbi_pmu_mux_context *ctx)
+{
+	struct pmu_mux_state *ms = pmu_mux_thishart_ptr();
+
+	if (!ms || !ctx->registered)
+		return;
+
+	pmu_mux_register(ms, ctx->shmem, ctx->num_events, ctx->cmask,
+			 ctx->period);
+	ms->next = ctx->next;
+	if (ctx->running)
+		pmu_mux_run(ms);
+}
+
+int sbi_pmu_mux_init(struct sbi_scratch *scratch, bool cold_boot)
+{
+	struct pmu_mux_state *ms;
+
+	if (cold_boot) {
+		pmu_mux_off = sbi_scratch_alloc_offset(sizeof(ms));
+		if (!pmu_mux_off)
+			return SBI_ENOMEM;
+	} else if (!pmu_mux_off) {
+		return SBI_ENOMEM;
+	}
+
+	ms = sbi_scratch_read_type(scratch, struct pmu_mux_state *,
+				   pmu_mux_off);
+	if (!ms) {
+		ms = sbi_zalloc(sizeof(*ms));
+		if (!ms)
+			return SBI_ENOMEM;
+		sbi_scratch_write_type(scratch, struct pmu_mux_state *,
+				       pmu_mux_off, ms);
+	}
+
+	SBI_INIT_TIMER_EVENT(&ms->event, pmu_mux_event_callback,
+			     pmu_mux_event_cleanup, ms);
+	ms->running = false;
+	ms->num_active = 0;
+	ms->shmem = PMU_MUX_SHMEM_INVALID;
+
+	return 0;
+}
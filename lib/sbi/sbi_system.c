@@ -10,8 +10,10 @@
 
 #include <sbi/riscv_asm.h>
 #include <sbi/sbi_bitops.h>
+#include <sbi/sbi_console.h>
 #include <sbi/sbi_domain.h>
 #include <sbi/sbi_hart.h>
+#include <sbi/sbi_hotpc.h>
 #include <sbi/sbi_hsm.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_system.h>
@@ -71,6 +73,15 @@ void __noreturn sbi_system_reset(u32 reset_type, u32 reset_reason)
 	/* Send HALT IPI to every hart other than the current hart */
 	sbi_ipi_send_halt(0, -1UL);
 
+	/*
+	 * Best-effort snapshot, the HALT IPI is not waited for so other
+	 * harts may still be updating their emulation tables.
+	 */
+	sbi_hotpc_dump();
+
+	/* Nothing can be written out after the reset */
+	sbi_console_flush();
+
 	/* Stop current HART */
 	sbi_hsm_hart_stop(scratch, false);
 
@@ -15,19 +15,32 @@
 #include <sbi/sbi_error.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_hartmask.h>
+#include <sbi/sbi_heap.h>
+#include <sbi/sbi_ipi.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
 #include <sbi/sbi_scratch.h>
 #include <sbi/sbi_timer.h>
+#include <sbi/sbi_timer_test.h>
 
 struct timer_state {
+	/* HART owning the events queued on this state */
+	int hart_index;
 	u64 time_delta;
-	spinlock_t event_list_lock;
-	struct sbi_dlist event_list;
+	spinlock_t event_lock;
+	struct sbi_minheap event_heap;
 	struct sbi_timer_event smode_ev;
+	/* Events with requests from other HARTs, pushed without locking */
+	atomic_t inbox;
+	/* Earliest queued time stamp, published for other HARTs */
+	volatile unsigned long head_seq;
+	volatile u64 head_time;
+	/* Value last written to the timer device, -1ULL when stopped */
+	u64 dev_next;
 };
 
 static unsigned long timer_state_off;
+static u32 timer_ipi_event = SBI_IPI_EVENT_MAX;
 static u64 (*get_time_val)(void);
 static const struct sbi_timer_device *timer_dev = NULL;
 
@@ -147,29 +160,100 @@ void sbi_timer_set_delta_upper(ulong delta_upper)
 }
 #endif
 
+static void timer_head_publish(struct timer_state *tstate, u64 time)
+{
+	tstate->head_seq++;
+	smp_wmb();
+	tstate->head_time = time;
+	smp_wmb();
+	tstate->head_seq++;
+}
+
+static u64 timer_head_read(struct timer_state *tstate)
+{
+	unsigned long seq;
+	u64 time;
+
+	do {
+		seq = tstate->head_seq;
+		smp_rmb();
+		time = tstate->head_time;
+		smp_rmb();
+	} while ((seq & 1) || seq != tstate->head_seq);
+
+	return time;
+}
+
+static struct timer_state *timer_hart_state(int hart_index)
+{
+	return sbi_scratch_offset_ptr(sbi_hartindex_to_scratch(hart_index),
+				      timer_state_off);
+}
+
+static void __sbi_timer_inbox_process(struct timer_state *tstate);
+
+static struct sbi_minheap_node *timer_head_update(struct timer_state *tstate)
+{
+	struct sbi_minheap_node *node;
+
+again:
+	node = sbi_minheap_first(&tstate->event_heap);
+	timer_head_publish(tstate, node ? node->key : -1ULL);
+
+	/*
+	 * Other HARTs push onto the inbox and then compare against the
+	 * published head, so an event pushed after the inbox was last
+	 * processed is either seen here or seen the new head and sent
+	 * an IPI if it can't wait for it.
+	 */
+	smp_mb();
+	if (atomic_read(&tstate->inbox)) {
+		__sbi_timer_inbox_process(tstate);
+		goto again;
+	}
+
+	return node;
+}
+
 static void __sbi_timer_update_device(struct timer_state *tstate)
 {
-	struct sbi_timer_event *ev;
+	struct sbi_minheap_node *node = timer_head_update(tstate);
 
 	if (!timer_dev)
 		return;
 
-	if (sbi_list_empty(&tstate->event_list)) {
-		if (timer_dev->timer_event_stop)
+	/*
+	 * Events which share an expiry thanks to their slack don't
+	 * need the device to be written again.
+	 */
+	if (!node) {
+		if (tstate->dev_next != -1ULL && timer_dev->timer_event_stop)
 			timer_dev->timer_event_stop();
+		tstate->dev_next = -1ULL;
 		csr_clear(CSR_MIE, MIP_MTIP);
 	} else {
-		ev = sbi_list_first_entry(&tstate->event_list, struct sbi_timer_event, head);
-		if (timer_dev->timer_event_start)
-			timer_dev->timer_event_start(ev->time_stamp);
+		if (tstate->dev_next != node->key &&
+		    timer_dev->timer_event_start)
+			timer_dev->timer_event_start(node->key);
+		tstate->dev_next = node->key;
 		csr_set(CSR_MIE, MIP_MTIP);
 	}
 }
 
-static void __sbi_timer_event_stop(struct sbi_timer_event *ev)
+/* Latest time stamp at which an event started at @time must fire */
+static u64 timer_event_deadline(struct sbi_timer_event *ev, u64 time)
+{
+	u64 deadline = time + ev->slack;
+
+	return (deadline < time) ? -1ULL : deadline;
+}
+
+static void __sbi_timer_event_stop(struct timer_state *tstate,
+				   struct sbi_timer_event *ev)
 {
 	if (ev->hart_index > -1) {
-		sbi_list_del(&ev->head);
+		if (sbi_minheap_node_linked(&tstate->event_heap, &ev->node))
+			sbi_minheap_remove(&tstate->event_heap, &ev->node);
 		ev->hart_index = -1;
 	}
 }
@@ -177,74 +261,221 @@ static void __sbi_timer_event_stop(struct sbi_timer_event *ev)
 static void __sbi_timer_event_start(struct timer_state *tstate,
 				    struct sbi_timer_event *ev, u64 next_event)
 {
-	struct sbi_timer_event *tev, *next_ev = NULL;
+	/* Insert the event in per-HART event heap by its latest expiry */
+	ev->hart_index = tstate->hart_index;
+	ev->expiry = next_event;
+	ev->node.key = timer_event_deadline(ev, next_event);
+	sbi_minheap_insert(&tstate->event_heap, &ev->node);
+}
 
-	/* Find where to insert the event in per-HART event list */
-	sbi_list_for_each_entry(tev, &tstate->event_list, head) {
-		if (next_event < tev->time_stamp) {
-			next_ev = tev;
-			break;
-		}
+/*
+ * The latest start / stop request of an event is kept in the event
+ * itself. Only one request per event is in flight at any time, the
+ * HART holding inbox_busy applies whatever is the latest request when
+ * it gets to it, so inboxes never overflow.
+ */
+static void timer_event_req_write(struct sbi_timer_event *ev,
+				  u64 time, int hart_index)
+{
+	ev->req_seq++;
+	smp_wmb();
+	ev->req_time = time;
+	ev->req_hart = hart_index;
+	smp_wmb();
+	ev->req_seq++;
+}
+
+static unsigned long timer_event_req_read(struct sbi_timer_event *ev,
+					  u64 *time, int *hart_index)
+{
+	unsigned long seq;
+
+	do {
+		seq = ev->req_seq;
+		smp_rmb();
+		*time = ev->req_time;
+		*hart_index = ev->req_hart;
+		smp_rmb();
+	} while ((seq & 1) || seq != ev->req_seq);
+
+	return seq;
+}
+
+/* Interrupt a HART if @time is earlier than its earliest event */
+static void timer_inbox_kick(int hart_index, u64 time)
+{
+	if (hart_index < 0 || SBI_IPI_EVENT_MAX <= timer_ipi_event)
+		return;
+
+	if (time < timer_head_read(timer_hart_state(hart_index)))
+		sbi_ipi_send_many(1, sbi_hartindex_to_hartid(hart_index),
+				  timer_ipi_event, NULL);
+}
+
+static void timer_inbox_push(struct timer_state *tstate,
+			     struct sbi_timer_event *ev)
+{
+	long old;
+
+	ev->inbox_hart = tstate->hart_index;
+	do {
+		old = atomic_read(&tstate->inbox);
+		ev->inbox_next = (struct sbi_timer_event *)old;
+	} while (atomic_cmpxchg(&tstate->inbox, old, (long)ev) != old);
+
+	/* Order the push before reading the head in timer_inbox_kick() */
+	smp_mb();
+}
+
+/*
+ * Drop inbox_busy after working on an event. Returns true if a newer
+ * request came in meanwhile and inbox_busy was taken again to apply it.
+ */
+static bool timer_event_release(struct sbi_timer_event *ev)
+{
+	atomic_xchg(&ev->inbox_busy, 0);
+
+	return ev->req_seq != ev->req_done &&
+	       !atomic_xchg(&ev->inbox_busy, 1);
+}
+
+/* Apply the latest request of an event on the current HART */
+static void timer_event_apply(struct timer_state *tstate,
+			      struct sbi_timer_event *ev)
+{
+	int hart_index = tstate->hart_index;
+	unsigned long seq;
+	int owner, target;
+	u64 time;
+
+again:
+	seq = timer_event_req_read(ev, &time, &target);
+
+	/* Only the owner HART can take the event off its heap */
+	owner = ev->hart_index;
+	if (owner > -1 && owner != hart_index) {
+		timer_inbox_push(timer_hart_state(owner), ev);
+		goto kick;
 	}
 
-	/* Insert the event in per-HART event list */
-	ev->hart_index = current_hartindex();
-	ev->time_stamp = next_event;
-	if (next_ev)
-		sbi_list_add(&ev->head, &next_ev->head);
+	__sbi_timer_event_stop(tstate, ev);
+	if (target == hart_index) {
+		__sbi_timer_event_start(tstate, ev, time);
+	} else if (target > -1) {
+		/* Hand the event over to the target HART */
+		ev->hart_index = owner = target;
+		timer_inbox_push(timer_hart_state(target), ev);
+		goto kick;
+	}
+
+	ev->req_done = seq;
+	if (timer_event_release(ev))
+		goto again;
+
+	return;
+
+kick:
+	/* The request may have changed since it was read above */
+	if (seq != ev->req_seq)
+		timer_event_req_read(ev, &time, &target);
+	if (target > -1)
+		timer_inbox_kick(owner, timer_event_deadline(ev, time));
 	else
-		sbi_list_add_tail(&ev->head, &tstate->event_list);
+		timer_inbox_kick(owner, 0);
 }
 
-void sbi_timer_event_start(struct sbi_timer_event *ev, u64 next_event)
+static void __sbi_timer_inbox_process(struct timer_state *tstate)
+{
+	struct sbi_timer_event *ev, *next;
+
+	/*
+	 * Each event is on at most one inbox, so the order in which
+	 * the requests of different events are applied does not matter.
+	 */
+	ev = (struct sbi_timer_event *)atomic_xchg(&tstate->inbox, 0);
+	for (; ev; ev = next) {
+		next = ev->inbox_next;
+		timer_event_apply(tstate, ev);
+	}
+}
+
+static void sbi_timer_inbox_process(struct sbi_scratch *scratch)
+{
+	struct timer_state *tstate = sbi_scratch_offset_ptr(scratch,
+							    timer_state_off);
+
+	spin_lock(&tstate->event_lock);
+	__sbi_timer_inbox_process(tstate);
+	__sbi_timer_update_device(tstate);
+	spin_unlock(&tstate->event_lock);
+}
+
+static struct sbi_ipi_event_ops timer_ipi_ops = {
+	.name = "IPI_TIMER",
+	.process = sbi_timer_inbox_process,
+};
+
+static void timer_event_request(struct sbi_timer_event *ev, u64 time,
+				int target)
 {
+	int hart_index = current_hartindex();
 	struct timer_state *tstate;
+	int owner;
 
-	if (!ev)
+	timer_event_req_write(ev, time, target);
+
+	/* The HART holding the in-flight request will pick this one up */
+	if (atomic_xchg(&ev->inbox_busy, 1)) {
+		timer_inbox_kick(ev->inbox_hart, target > -1 ?
+				 timer_event_deadline(ev, time) : 0);
 		return;
+	}
 
-	/* Ensure that event is not on the per-HART event list */
-	if (ev->hart_index > -1) {
-		tstate = sbi_scratch_offset_ptr(sbi_hartindex_to_scratch(ev->hart_index),
-						timer_state_off);
-		spin_lock(&tstate->event_list_lock);
-		__sbi_timer_event_stop(ev);
-		spin_unlock(&tstate->event_list_lock);
+	/*
+	 * An event queued on another HART is handed over through the
+	 * inbox of that HART instead of taking its lock, and the HART
+	 * is only interrupted if the request can't wait until its
+	 * earliest event fires.
+	 */
+	owner = ev->hart_index;
+	if (owner > -1 && owner != hart_index) {
+		timer_inbox_push(timer_hart_state(owner), ev);
+		timer_inbox_kick(owner, target > -1 ?
+				 timer_event_deadline(ev, time) : 0);
+		return;
 	}
 
 	tstate = sbi_scratch_thishart_offset_ptr(timer_state_off);
-	spin_lock(&tstate->event_list_lock);
-
-	__sbi_timer_event_start(tstate, ev, next_event);
+	spin_lock(&tstate->event_lock);
+	timer_event_apply(tstate, ev);
 	__sbi_timer_update_device(tstate);
+	spin_unlock(&tstate->event_lock);
+}
+
+void sbi_timer_event_start(struct sbi_timer_event *ev, u64 next_event)
+{
+	if (!ev)
+		return;
 
-	spin_unlock(&tstate->event_list_lock);
+	timer_event_request(ev, next_event, current_hartindex());
 }
 
 void sbi_timer_event_stop(struct sbi_timer_event *ev)
 {
-	struct timer_state *tstate;
-	int ev_hart_index;
+	struct sbi_scratch *scratch = sbi_scratch_thishart_ptr();
 
 	if (!ev)
 		return;
 
-	/* Ensure that event is not on the per-HART event list */
-	ev_hart_index = ev->hart_index;
-	if (ev->hart_index > -1) {
-		tstate = sbi_scratch_offset_ptr(sbi_hartindex_to_scratch(ev->hart_index),
-						timer_state_off);
-		spin_lock(&tstate->event_list_lock);
-		__sbi_timer_event_stop(ev);
-		spin_unlock(&tstate->event_list_lock);
-	}
+	timer_event_request(ev, 0, -1);
 
-	/* Re-program timer device on the current HART */
-	if (ev_hart_index == current_hartindex()) {
-		tstate = sbi_scratch_thishart_offset_ptr(timer_state_off);
-		spin_lock(&tstate->event_list_lock);
-		__sbi_timer_update_device(tstate);
-		spin_unlock(&tstate->event_list_lock);
+	/*
+	 * Wait for the owner HART to drop the event. Keep serving our
+	 * own inbox meanwhile since the owner may be waiting on us.
+	 */
+	while (atomic_read(&ev->inbox_busy)) {
+		sbi_timer_inbox_process(scratch);
+		cpu_relax();
 	}
 }
 
@@ -285,41 +516,77 @@ void sbi_timer_smode_event_start(u64 next_event)
 	}
 }
 
-void sbi_timer_process(void)
+static void __sbi_timer_process(struct timer_state *tstate, u64 now)
 {
-	struct timer_state *tstate = sbi_scratch_thishart_offset_ptr(timer_state_off);
 	struct sbi_timer_event_restart restart;
-	SBI_LIST_HEAD(restart_list);
+	struct sbi_minheap restart_heap;
+	struct sbi_minheap_node *node;
 	struct sbi_timer_event *ev;
 
-	spin_lock(&tstate->event_list_lock);
+	SBI_INIT_MINHEAP(&restart_heap);
+
+	__sbi_timer_inbox_process(tstate);
 
-	while (!sbi_list_empty(&tstate->event_list)) {
-		ev = sbi_list_first_entry(&tstate->event_list, struct sbi_timer_event, head);
-		if (ev->time_stamp > sbi_timer_value())
+	/*
+	 * The device is programmed with the latest expiry of the first
+	 * event. Fire every event from the front whose window has opened
+	 * so that events with overlapping windows share one interrupt.
+	 */
+	while ((node = sbi_minheap_first(&tstate->event_heap))) {
+		ev = container_of(node, struct sbi_timer_event, node);
+		if (ev->expiry > now)
 			break;
 
-		__sbi_timer_event_stop(ev);
+		/*
+		 * A newer request is on its way to this HART, so leave
+		 * the event to it instead of firing a stale expiry.
+		 */
+		if (atomic_xchg(&ev->inbox_busy, 1)) {
+			sbi_minheap_remove(&tstate->event_heap, node);
+			continue;
+		}
+
+		__sbi_timer_event_stop(tstate, ev);
 		if (ev->callback) {
 			restart.required = false;
 			restart.next_event = 0;
 			ev->callback(ev, &restart);
+			/*
+			 * Park restarted events until all expired events
+			 * are processed so that an event restarted in the
+			 * past does not fire again in this pass.
+			 */
 			if (restart.required) {
-				ev->time_stamp = restart.next_event;
-				sbi_list_add_tail(&ev->head, &restart_list);
+				ev->node.key = restart.next_event;
+				sbi_minheap_insert(&restart_heap, &ev->node);
+				continue;
 			}
 		}
+
+		if (timer_event_release(ev))
+			timer_event_apply(tstate, ev);
 	}
 
-	while (!sbi_list_empty(&restart_list)) {
-		ev = sbi_list_first_entry(&tstate->event_list, struct sbi_timer_event, head);
-		sbi_list_del(&ev->head);
-		__sbi_timer_event_start(tstate, ev, ev->time_stamp);
+	while ((node = sbi_minheap_first(&restart_heap))) {
+		sbi_minheap_remove(&restart_heap, node);
+		ev = container_of(node, struct sbi_timer_event, node);
+		__sbi_timer_event_start(tstate, ev, node->key);
+		if (timer_event_release(ev))
+			timer_event_apply(tstate, ev);
 	}
+}
+
+void sbi_timer_process(void)
+{
+	struct timer_state *tstate = sbi_scratch_thishart_offset_ptr(timer_state_off);
 
+	spin_lock(&tstate->event_lock);
+	__sbi_timer_process(tstate, sbi_timer_value());
 	__sbi_timer_update_device(tstate);
+	spin_unlock(&tstate->event_lock);
 
-	spin_unlock(&tstate->event_list_lock);
+	/* Use the timer interrupt to write out buffered console output */
+	sbi_console_drain();
 }
 
 const struct sbi_timer_device *sbi_timer_get_device(void)
@@ -337,6 +604,21 @@ void sbi_timer_set_device(const struct sbi_timer_device *dev)
 		get_time_val = timer_dev->timer_value;
 }
 
+static void timer_state_init(struct timer_state *tstate, int hart_index)
+{
+	tstate->hart_index = hart_index;
+	tstate->time_delta = 0;
+	SPIN_LOCK_INIT(tstate->event_lock);
+	SBI_INIT_MINHEAP(&tstate->event_heap);
+	ATOMIC_INIT(&tstate->inbox, 0);
+	tstate->head_seq = 0;
+	tstate->head_time = -1ULL;
+	tstate->dev_next = -1ULL;
+	SBI_INIT_TIMER_EVENT(&tstate->smode_ev,
+			     sbi_timer_smode_event_callback,
+			     sbi_timer_smode_event_cleanup, NULL);
+}
+
 int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 {
 	const struct sbi_platform *plat = sbi_platform_ptr(scratch);
@@ -348,6 +630,11 @@ int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 		if (!timer_state_off)
 			return SBI_ENOMEM;
 
+		ret = sbi_ipi_event_create(&timer_ipi_ops);
+		if (ret < 0)
+			return ret;
+		timer_ipi_event = ret;
+
 		if (sbi_hart_has_csr(scratch, SBI_HART_CSR_TIME))
 			get_time_val = get_ticks;
 
@@ -357,15 +644,12 @@ int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 	} else {
 		if (!timer_state_off)
 			return SBI_ENOMEM;
+		if (SBI_IPI_EVENT_MAX <= timer_ipi_event)
+			return SBI_ENOSPC;
 	}
 
 	tstate = sbi_scratch_offset_ptr(scratch, timer_state_off);
-	tstate->time_delta = 0;
-	SPIN_LOCK_INIT(tstate->event_list_lock);
-	SBI_INIT_LIST_HEAD(&tstate->event_list);
-	SBI_INIT_TIMER_EVENT(&tstate->smode_ev,
-			     sbi_timer_smode_event_callback,
-			     sbi_timer_smode_event_cleanup, NULL);
+	timer_state_init(tstate, sbi_scratch_hartindex(scratch));
 
 	if (timer_dev && timer_dev->warm_init) {
 		ret = timer_dev->warm_init();
@@ -379,18 +663,88 @@ int sbi_timer_init(struct sbi_scratch *scratch, bool cold_boot)
 void sbi_timer_exit(struct sbi_scratch *scratch)
 {
 	struct timer_state *tstate = sbi_scratch_thishart_offset_ptr(timer_state_off);
+	struct sbi_minheap_node *node;
 	struct sbi_timer_event *ev;
 
-	spin_lock(&tstate->event_list_lock);
+	spin_lock(&tstate->event_lock);
 
-	while (!sbi_list_empty(&tstate->event_list)) {
-		ev = sbi_list_first_entry(&tstate->event_list, struct sbi_timer_event, head);
-		__sbi_timer_event_stop(ev);
+	__sbi_timer_inbox_process(tstate);
+
+	while ((node = sbi_minheap_first(&tstate->event_heap))) {
+		ev = container_of(node, struct sbi_timer_event, node);
+		__sbi_timer_event_stop(tstate, ev);
 		if (ev->cleanup)
 			ev->cleanup(ev);
 	}
 
 	__sbi_timer_update_device(tstate);
 
-	spin_unlock(&tstate->event_list_lock);
+	spin_unlock(&tstate->event_lock);
+}
+
+#ifdef CONFIG_SBIUNIT
+struct timer_state *sbi_timer_test_state_alloc(void)
+{
+	struct timer_state *tstate = sbi_zalloc(sizeof(*tstate));
+
+	if (tstate)
+		timer_state_init(tstate, current_hartindex());
+	return tstate;
+}
+
+void sbi_timer_test_state_free(struct timer_state *tstate)
+{
+	sbi_free(tstate);
+}
+
+void sbi_timer_test_event_start(struct timer_state *tstate,
+				struct sbi_timer_event *ev, u64 next_event)
+{
+	__sbi_timer_event_start(tstate, ev, next_event);
+}
+
+void sbi_timer_test_event_stop(struct timer_state *tstate,
+			       struct sbi_timer_event *ev)
+{
+	__sbi_timer_event_stop(tstate, ev);
+}
+
+void sbi_timer_test_request(struct sbi_timer_event *ev, u64 time, int target)
+{
+	timer_event_req_write(ev, time, target);
+	atomic_xchg(&ev->inbox_busy, 1);
+}
+
+void sbi_timer_test_push(struct timer_state *tstate,
+			 struct sbi_timer_event *ev)
+{
+	timer_inbox_push(tstate, ev);
+}
+
+bool sbi_timer_test_pending(struct timer_state *tstate)
+{
+	return atomic_read(&tstate->inbox) != 0;
+}
+
+bool sbi_timer_test_queued(struct timer_state *tstate,
+			   struct sbi_timer_event *ev)
+{
+	return sbi_minheap_node_linked(&tstate->event_heap, &ev->node);
 }
+
+u64 sbi_timer_test_head(struct timer_state *tstate)
+{
+	return timer_head_read(tstate);
+}
+
+void sbi_timer_test_update_head(struct timer_state *tstate)
+{
+	timer_head_update(tstate);
+}
+
+void sbi_timer_test_process(struct timer_state *tstate, u64 now)
+{
+	__sbi_timer_process(tstate, now);
+	timer_head_update(tstate);
+}
+#endif
@@ -11,23 +11,41 @@
 #include <sbi/riscv_asm.h>
 #include <sbi/riscv_atomic.h>
 #include <sbi/riscv_barrier.h>
+#include <sbi/riscv_locks.h>
 #include <sbi/sbi_error.h>
-#include <sbi/sbi_fifo.h>
 #include <sbi/sbi_hart.h>
 #include <sbi/sbi_heap.h>
 #include <sbi/sbi_ipi.h>
+#include <sbi/sbi_mpsc.h>
 #include <sbi/sbi_scratch.h>
 #include <sbi/sbi_tlb.h>
 #include <sbi/sbi_hfence.h>
+#include <sbi/sbi_svinval.h>
 #include <sbi/sbi_string.h>
 #include <sbi/sbi_console.h>
 #include <sbi/sbi_platform.h>
 #include <sbi/sbi_pmu.h>
 
+/* Maximum number of coalesced entries flushed in one go */
+#define TLB_PROCESS_BATCH_MAX		8
+/* Maximum number of queued requests dequeued in one go (fits in u8) */
+#define TLB_PROCESS_DEQUEUE_MAX		32
+
+/* Request passed from sbi_tlb_request*() to the IPI update callback */
+struct tlb_request {
+	/* Array of TLB entries to queue on every target */
+	struct sbi_tlb_info *tinfo;
+	/* Number of entries in the array */
+	u32 count;
+	/* Per-target number of already queued entries (batches only) */
+	u16 *queued;
+};
+
 static unsigned long tlb_sync_off;
-static unsigned long tlb_fifo_off;
-static unsigned long tlb_fifo_mem_off;
-static unsigned long tlb_range_flush_limit;
+static unsigned long tlb_queue_off;
+static unsigned long tlb_queue_mem_off;
+static unsigned long tlb_stats_off;
+static unsigned long tlb_hart_off;
 
 void __sbi_sfence_vma_all(void)
 {
@@ -176,68 +194,399 @@ static void sbi_tlb_local_fence_i(struct sbi_tlb_info *tinfo)
 	__asm__ __volatile("fence.i");
 }
 
+/*
+ * Svinval flush engine: the per-page invalidations are not ordered against
+ * each other so they can be pipelined by the hart, the ordering with respect
+ * to page table updates is provided once by the surrounding
+ * SFENCE.W.INVAL and SFENCE.INVAL.IR pair.
+ */
+static void sbi_tlb_local_hinval_vvma(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long vmid  = tinfo->vmid;
+	unsigned long i, hgatp;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_HFENCE_VVMA_RCVD);
+
+	hgatp = csr_swap(CSR_HGATP,
+			 (vmid << HGATP_VMID_SHIFT) & HGATP_VMID_MASK);
+
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__sbi_hfence_vvma_all();
+		goto done;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_hinval_vvma_va(start + i);
+	__sbi_sfence_inval_ir();
+
+done:
+	csr_write(CSR_HGATP, hgatp);
+}
+
+static void sbi_tlb_local_hinval_gvma(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long i;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_HFENCE_GVMA_RCVD);
+
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__sbi_hfence_gvma_all();
+		return;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_hinval_gvma_gpa((start + i) >> 2);
+	__sbi_sfence_inval_ir();
+}
+
+static void sbi_tlb_local_sinval_vma(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long i;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_SFENCE_VMA_RCVD);
+
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__sbi_sfence_vma_all();
+		return;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_sinval_vma_va(start + i);
+	__sbi_sfence_inval_ir();
+}
+
+static void sbi_tlb_local_hinval_vvma_asid(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long asid  = tinfo->asid;
+	unsigned long vmid  = tinfo->vmid;
+	unsigned long i, hgatp;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_HFENCE_VVMA_ASID_RCVD);
+
+	hgatp = csr_swap(CSR_HGATP,
+			 (vmid << HGATP_VMID_SHIFT) & HGATP_VMID_MASK);
+
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__sbi_hfence_vvma_asid(asid);
+		goto done;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_hinval_vvma_asid_va(start + i, asid);
+	__sbi_sfence_inval_ir();
+
+done:
+	csr_write(CSR_HGATP, hgatp);
+}
+
+static void sbi_tlb_local_hinval_gvma_vmid(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long vmid  = tinfo->vmid;
+	unsigned long i;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_HFENCE_GVMA_VMID_RCVD);
+
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__sbi_hfence_gvma_vmid(vmid);
+		return;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_hinval_gvma_vmid_gpa((start + i) >> 2, vmid);
+	__sbi_sfence_inval_ir();
+}
+
+static void sbi_tlb_local_sinval_vma_asid(struct sbi_tlb_info *tinfo)
+{
+	unsigned long start = tinfo->start;
+	unsigned long size  = tinfo->size;
+	unsigned long asid  = tinfo->asid;
+	unsigned long i;
+
+	sbi_pmu_ctr_incr_fw(SBI_PMU_FW_SFENCE_VMA_ASID_RCVD);
+
+	/* Flush entire MM context for a given ASID */
+	if ((start == 0 && size == 0) || (size == SBI_TLB_FLUSH_ALL)) {
+		__asm__ __volatile__("sfence.vma x0, %0"
+				     :
+				     : "r"(asid)
+				     : "memory");
+		return;
+	}
+
+	__sbi_sfence_w_inval();
+	for (i = 0; i < size; i += PAGE_SIZE)
+		__sbi_sinval_vma_asid_va(start + i, asid);
+	__sbi_sfence_inval_ir();
+}
+
+typedef void (*tlb_local_flush_t)(struct sbi_tlb_info *tinfo);
+
+/* Per-HART flush configuration chosen at boot */
+struct tlb_hart_state {
+	/* Local flush handlers indexed by TLB request type */
+	const tlb_local_flush_t *engine;
+	/* Range size above which a full flush is done instead */
+	unsigned long flush_limit;
+};
+
+/* Flush engine using one fenced instruction per page */
+static const tlb_local_flush_t tlb_fence_engine[SBI_TLB_TYPE_MAX] = {
+	[SBI_TLB_FENCE_I] = sbi_tlb_local_fence_i,
+	[SBI_TLB_SFENCE_VMA] = sbi_tlb_local_sfence_vma,
+	[SBI_TLB_SFENCE_VMA_ASID] = sbi_tlb_local_sfence_vma_asid,
+	[SBI_TLB_HFENCE_GVMA_VMID] = sbi_tlb_local_hfence_gvma_vmid,
+	[SBI_TLB_HFENCE_GVMA] = sbi_tlb_local_hfence_gvma,
+	[SBI_TLB_HFENCE_VVMA_ASID] = sbi_tlb_local_hfence_vvma_asid,
+	[SBI_TLB_HFENCE_VVMA] = sbi_tlb_local_hfence_vvma,
+};
+
+/* Flush engine for harts implementing Svinval */
+static const tlb_local_flush_t tlb_svinval_engine[SBI_TLB_TYPE_MAX] = {
+	[SBI_TLB_FENCE_I] = sbi_tlb_local_fence_i,
+	[SBI_TLB_SFENCE_VMA] = sbi_tlb_local_sinval_vma,
+	[SBI_TLB_SFENCE_VMA_ASID] = sbi_tlb_local_sinval_vma_asid,
+	[SBI_TLB_HFENCE_GVMA_VMID] = sbi_tlb_local_hinval_gvma_vmid,
+	[SBI_TLB_HFENCE_GVMA] = sbi_tlb_local_hinval_gvma,
+	[SBI_TLB_HFENCE_VVMA_ASID] = sbi_tlb_local_hinval_vvma_asid,
+	[SBI_TLB_HFENCE_VVMA] = sbi_tlb_local_hinval_vvma,
+};
+
 static void tlb_entry_local_process(struct sbi_tlb_info *data)
 {
+	struct tlb_hart_state *ths;
+	struct sbi_tlb_info full;
+
 	if (unlikely(!data))
 		return;
 
-	switch (data->type) {
-	case SBI_TLB_FENCE_I:
-		sbi_tlb_local_fence_i(data);
-		break;
-	case SBI_TLB_SFENCE_VMA:
-		sbi_tlb_local_sfence_vma(data);
-		break;
+	if (data->type < 0 || data->type >= SBI_TLB_TYPE_MAX)
+		return;
+
+	/*
+	 * If address range to flush is too big then simply
+	 * upgrade it to flush all because we can only flush
+	 * 4KB at a time. The limit of this HART is used since
+	 * the HART sending the request may have another one.
+	 */
+	ths = sbi_scratch_thishart_offset_ptr(tlb_hart_off);
+	if (data->size > ths->flush_limit) {
+		full = *data;
+		full.start = 0;
+		full.size = SBI_TLB_FLUSH_ALL;
+		data = &full;
+	}
+
+	ths->engine[data->type](data);
+}
+
+/* Set of coalesced TLB entries collected by tlb_process_once() */
+struct tlb_batch {
+	/* Coalesced entries to be flushed locally */
+	struct sbi_tlb_info entries[TLB_PROCESS_BATCH_MAX];
+	u32 count;
+	/* Source harts of the dequeued entries */
+	struct sbi_hartmask sources;
+	/* Per-source number of dequeued entries to acknowledge */
+	u8 release[SBI_HARTMASK_MAX_BITS];
+	/* Number of entries folded into another one */
+	u32 merged;
+	/* Number of coalesced ranges promoted to a full flush */
+	u32 promoted;
+	/* Flush limit of the HART processing the batch */
+	unsigned long flush_limit;
+};
+
+static inline bool tlb_is_flush_all(struct sbi_tlb_info *tinfo)
+{
+	return (tinfo->start == 0 && tinfo->size == 0) ||
+	       (tinfo->size == SBI_TLB_FLUSH_ALL);
+}
+
+static inline unsigned long tlb_range_end(struct sbi_tlb_info *tinfo)
+{
+	/* Saturate so that bogus ranges can't wrap around */
+	if (tinfo->size > -1UL - tinfo->start)
+		return -1UL;
+
+	return tinfo->start + tinfo->size;
+}
+
+/* Check whether two entries flush the same address space */
+static bool tlb_same_context(struct sbi_tlb_info *curr,
+			     struct sbi_tlb_info *next)
+{
+	if (curr->type != next->type)
+		return false;
+
+	switch (curr->type) {
 	case SBI_TLB_SFENCE_VMA_ASID:
-		sbi_tlb_local_sfence_vma_asid(data);
-		break;
+		return curr->asid == next->asid;
 	case SBI_TLB_HFENCE_GVMA_VMID:
-		sbi_tlb_local_hfence_gvma_vmid(data);
-		break;
-	case SBI_TLB_HFENCE_GVMA:
-		sbi_tlb_local_hfence_gvma(data);
-		break;
-	case SBI_TLB_HFENCE_VVMA_ASID:
-		sbi_tlb_local_hfence_vvma_asid(data);
-		break;
 	case SBI_TLB_HFENCE_VVMA:
-		sbi_tlb_local_hfence_vvma(data);
-		break;
+		return curr->vmid == next->vmid;
+	case SBI_TLB_HFENCE_VVMA_ASID:
+		return curr->asid == next->asid && curr->vmid == next->vmid;
 	default:
-		break;
-	};
+		return true;
+	}
 }
 
-static void tlb_entry_process(struct sbi_tlb_info *tinfo)
+/**
+ * Try to fold a dequeued entry into an entry of the current batch. Here are
+ * the different cases that are being handled for entries flushing the same
+ * address space (same type, ASID and VMID).
+ *
+ * Case1:
+ *	fence.i requests carry no range so duplicates are simply dropped.
+ * Case2:
+ *	if either entry is a full flush, the batch entry becomes a full flush.
+ * Case3:
+ *	if the ranges overlap or are adjacent, the batch entry is widened to
+ *	their union. A union larger than the flush limit is promoted
+ *	to a full flush, same as an oversized request in
+ *	tlb_entry_local_process().
+ *
+ * The source harts are not tracked per entry: every dequeued entry is
+ * acknowledged once the whole batch has been flushed.
+ */
+static bool tlb_entry_merge(struct tlb_batch *batch,
+			    struct sbi_tlb_info *curr,
+			    struct sbi_tlb_info *next)
 {
-	u32 rindex;
+	unsigned long curr_end, next_end, start, end;
+
+	if (!tlb_same_context(curr, next))
+		return false;
+
+	if (curr->type == SBI_TLB_FENCE_I || tlb_is_flush_all(curr))
+		goto merged;
+
+	if (tlb_is_flush_all(next))
+		goto flush_all;
+
+	curr_end = tlb_range_end(curr);
+	next_end = tlb_range_end(next);
+	if (next->start > curr_end || curr->start > next_end)
+		return false;
+
+	start = (curr->start < next->start) ? curr->start : next->start;
+	end = (curr_end > next_end) ? curr_end : next_end;
+	if (end - start > batch->flush_limit) {
+		batch->promoted++;
+		goto flush_all;
+	}
+
+	curr->start = start;
+	curr->size = end - start;
+	goto merged;
+
+flush_all:
+	curr->start = 0;
+	curr->size = SBI_TLB_FLUSH_ALL;
+merged:
+	batch->merged++;
+	return true;
+}
+
+static void tlb_batch_add(struct tlb_batch *batch, struct sbi_tlb_info *tinfo)
+{
+	u32 i, rindex;
+
+	sbi_hartmask_for_each_hartindex(rindex, &tinfo->smask) {
+		if (!sbi_hartmask_test_hartindex(rindex, &batch->sources)) {
+			sbi_hartmask_set_hartindex(rindex, &batch->sources);
+			batch->release[rindex] = 0;
+		}
+		batch->release[rindex]++;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		if (tlb_entry_merge(batch, &batch->entries[i], tinfo))
+			return;
+	}
+
+	batch->entries[batch->count++] = *tinfo;
+}
+
+static void tlb_batch_process(struct sbi_scratch *scratch,
+			      struct tlb_batch *batch)
+{
+	u32 i, rindex;
 	struct sbi_scratch *rscratch = NULL;
+	struct sbi_tlb_stats *stats;
 	atomic_t *rtlb_sync = NULL;
 
-	tlb_entry_local_process(tinfo);
+	for (i = 0; i < batch->count; i++)
+		tlb_entry_local_process(&batch->entries[i]);
 
-	sbi_hartmask_for_each_hartindex(rindex, &tinfo->smask) {
+	sbi_hartmask_for_each_hartindex(rindex, &batch->sources) {
 		rscratch = sbi_hartindex_to_scratch(rindex);
 		if (!rscratch)
 			continue;
 
 		rtlb_sync = sbi_scratch_offset_ptr(rscratch, tlb_sync_off);
-		atomic_sub_return(rtlb_sync, 1);
+		atomic_sub_return(rtlb_sync, batch->release[rindex]);
+	}
+
+	if (batch->merged || batch->promoted) {
+		stats = sbi_scratch_offset_ptr(scratch, tlb_stats_off);
+		stats->merged += batch->merged;
+		stats->promoted += batch->promoted;
+		sbi_pmu_ctr_add_fw_internal(SBI_PMU_FW_INTERNAL_TLB_MERGED,
+					    batch->merged);
+		sbi_pmu_ctr_add_fw_internal(SBI_PMU_FW_INTERNAL_TLB_PROMOTED,
+					    batch->promoted);
 	}
 }
 
 static bool tlb_process_once(struct sbi_scratch *scratch)
 {
+	struct tlb_batch batch;
 	struct sbi_tlb_info tinfo;
-	struct sbi_fifo *tlb_fifo =
-			sbi_scratch_offset_ptr(scratch, tlb_fifo_off);
+	struct sbi_mpsc *tlb_q =
+			sbi_scratch_offset_ptr(scratch, tlb_queue_off);
+	struct tlb_hart_state *ths =
+			sbi_scratch_offset_ptr(scratch, tlb_hart_off);
+	u32 dequeued = 0;
 
-	if (!sbi_fifo_dequeue(tlb_fifo, &tinfo)) {
-		tlb_entry_process(&tinfo);
-		return true;
+	batch.count = batch.merged = batch.promoted = 0;
+	batch.flush_limit = ths->flush_limit;
+	sbi_hartmask_clear_all(&batch.sources);
+
+	/*
+	 * Stop once the batch has no room left for an entry which can't
+	 * be merged. Merged entries don't take room so the number of
+	 * dequeued entries is bounded separately.
+	 */
+	while (batch.count < TLB_PROCESS_BATCH_MAX &&
+	       dequeued < TLB_PROCESS_DEQUEUE_MAX &&
+	       !sbi_mpsc_dequeue(tlb_q, &tinfo)) {
+		tlb_batch_add(&batch, &tinfo);
+		dequeued++;
 	}
 
-	return false;
+	if (!dequeued)
+		return false;
+
+	tlb_batch_process(scratch, &batch);
+
+	return true;
 }
 
 static void tlb_process(struct sbi_scratch *scratch)
@@ -253,7 +602,7 @@ static void tlb_sync(struct sbi_scratch *scratch)
 	while (atomic_read(tlb_sync) > 0) {
 		/*
 		 * While we are waiting for remote hart to set the sync,
-		 * consume fifo requests to avoid deadlock.
+		 * consume queued requests to avoid deadlock.
 		 */
 		tlb_process_once(scratch);
 	}
@@ -261,81 +610,15 @@ static void tlb_sync(struct sbi_scratch *scratch)
 	return;
 }
 
-static inline int tlb_range_check(struct sbi_tlb_info *curr,
-					struct sbi_tlb_info *next)
-{
-	unsigned long curr_end;
-	unsigned long next_end;
-	int ret = SBI_FIFO_UNCHANGED;
-
-	if (!curr || !next)
-		return ret;
-
-	next_end = next->start + next->size;
-	curr_end = curr->start + curr->size;
-	if (next->start <= curr->start && next_end > curr_end) {
-		curr->start = next->start;
-		curr->size  = next->size;
-		sbi_hartmask_or(&curr->smask, &curr->smask, &next->smask);
-		ret = SBI_FIFO_UPDATED;
-	} else if (next->start >= curr->start && next_end <= curr_end) {
-		sbi_hartmask_or(&curr->smask, &curr->smask, &next->smask);
-		ret = SBI_FIFO_SKIP;
-	}
-
-	return ret;
-}
-
-/**
- * Call back to decide if an inplace fifo update is required or next entry can
- * can be skipped. Here are the different cases that are being handled.
- *
- * Case1:
- *	if next flush request range lies within one of the existing entry, skip
- *	the next entry.
- * Case2:
- *	if flush request range in current fifo entry lies within next flush
- *	request, update the current entry.
- *
- * Note:
- *	We can not issue a fifo reset anymore if a complete vma flush is requested.
- *	This is because we are queueing FENCE.I requests as well now.
- *	To ease up the pressure in enqueue/fifo sync path, try to dequeue 1 element
- *	before continuing the while loop. This method is preferred over wfi/ipi because
- *	of MMIO cost involved in later method.
- */
-static int tlb_update_cb(void *in, void *data)
-{
-	struct sbi_tlb_info *curr;
-	struct sbi_tlb_info *next;
-	int ret = SBI_FIFO_UNCHANGED;
-
-	if (!in || !data)
-		return ret;
-
-	curr = (struct sbi_tlb_info *)data;
-	next = (struct sbi_tlb_info *)in;
-
-	if (next->type == SBI_TLB_SFENCE_VMA_ASID &&
-	    curr->type == SBI_TLB_SFENCE_VMA_ASID) {
-		if (next->asid == curr->asid)
-			ret = tlb_range_check(curr, next);
-	} else if (next->type == SBI_TLB_SFENCE_VMA &&
-		   curr->type == SBI_TLB_SFENCE_VMA) {
-		ret = tlb_range_check(curr, next);
-	}
-
-	return ret;
-}
-
 static int tlb_update(struct sbi_scratch *scratch,
 			  struct sbi_scratch *remote_scratch,
 			  u32 remote_hartindex, void *data)
 {
-	int ret;
+	u32 i, done;
 	atomic_t *tlb_sync;
-	struct sbi_fifo *tlb_fifo_r;
-	struct sbi_tlb_info *tinfo = data;
+	struct sbi_mpsc *tlb_q_r;
+	struct sbi_tlb_stats *stats;
+	struct tlb_request *req = data;
 	u32 curr_hartid = current_hartid();
 
 	/*
@@ -343,39 +626,59 @@ static int tlb_update(struct sbi_scratch *scratch,
 	 * then just do a local flush and return;
 	 */
 	if (sbi_hartindex_to_hartid(remote_hartindex) == curr_hartid) {
-		tlb_entry_local_process(tinfo);
+		for (i = 0; i < req->count; i++)
+			tlb_entry_local_process(&req->tinfo[i]);
 		return SBI_IPI_UPDATE_BREAK;
 	}
 
-	tlb_fifo_r = sbi_scratch_offset_ptr(remote_scratch, tlb_fifo_off);
+	tlb_q_r = sbi_scratch_offset_ptr(remote_scratch, tlb_queue_off);
 
-	ret = sbi_fifo_inplace_update(tlb_fifo_r, data, tlb_update_cb);
+	done = req->queued ? req->queued[remote_hartindex] : 0;
+	for (i = done; i < req->count; i++) {
+		if (sbi_mpsc_enqueue(tlb_q_r, &req->tinfo[i]) < 0)
+			break;
+	}
 
-	if (ret == SBI_FIFO_UNCHANGED &&
-	    sbi_fifo_enqueue(tlb_fifo_r, data, false) < 0) {
-		/**
-		 * For now, Busy loop until there is space in the fifo.
-		 * There may be case where target hart is also
-		 * enqueue in source hart's fifo. Both hart may busy
-		 * loop leading to a deadlock.
-		 * TODO: Introduce a wait/wakeup event mechanism to handle
-		 * this properly.
-		 */
-		tlb_process_once(scratch);
-		sbi_dprintf("hart%d: hart%d tlb fifo full\n", curr_hartid,
+	if (i > done) {
+		tlb_sync = sbi_scratch_offset_ptr(scratch, tlb_sync_off);
+		atomic_add_return(tlb_sync, i - done);
+	}
+	if (req->queued)
+		req->queued[remote_hartindex] = i;
+
+	if (i < req->count) {
+		/* Park in tlb_wait() until the remote hart frees a slot */
+		stats = sbi_scratch_offset_ptr(scratch, tlb_stats_off);
+		stats->queue_full++;
+		sbi_dprintf("hart%d: hart%d tlb queue full\n", curr_hartid,
 			    sbi_hartindex_to_hartid(remote_hartindex));
 		return SBI_IPI_UPDATE_RETRY;
 	}
 
-	tlb_sync = sbi_scratch_offset_ptr(scratch, tlb_sync_off);
-	atomic_add_return(tlb_sync, 1);
-
 	return SBI_IPI_UPDATE_SUCCESS;
 }
 
+static void tlb_wait(struct sbi_scratch *scratch,
+		     struct sbi_scratch *remote_scratch)
+{
+	struct sbi_mpsc *tlb_q_r =
+			sbi_scratch_offset_ptr(remote_scratch, tlb_queue_off);
+
+	/*
+	 * The remote hart releases a slot with a store to the slot sequence
+	 * number which is what we poll here. The remote hart may itself be
+	 * parked on our queue so keep draining it while waiting.
+	 */
+	while (sbi_mpsc_is_full(tlb_q_r)) {
+		if (!tlb_process_once(scratch))
+			cpu_relax();
+	}
+}
+
 static struct sbi_ipi_event_ops tlb_ops = {
 	.name = "IPI_TLB",
 	.update = tlb_update,
+	.wait = tlb_wait,
 	.sync = tlb_sync,
 	.process = tlb_process,
 };
@@ -392,24 +695,187 @@ static const u32 tlb_type_to_pmu_fw_event[SBI_TLB_TYPE_MAX] = {
 	[SBI_TLB_HFENCE_VVMA] = SBI_PMU_FW_HFENCE_VVMA_SENT,
 };
 
-int sbi_tlb_request(ulong hmask, ulong hbase, struct sbi_tlb_info *tinfo)
+static int tlb_request_prepare(struct sbi_tlb_info *tinfo)
 {
 	if (tinfo->type < 0 || tinfo->type >= SBI_TLB_TYPE_MAX)
 		return SBI_EINVAL;
 
-	/*
-	 * If address range to flush is too big then simply
-	 * upgrade it to flush all because we can only flush
-	 * 4KB at a time.
-	 */
-	if (tinfo->size > tlb_range_flush_limit) {
-		tinfo->start = 0;
-		tinfo->size = SBI_TLB_FLUSH_ALL;
-	}
+	return 0;
+}
+
+int sbi_tlb_request(ulong hmask, ulong hbase, struct sbi_tlb_info *tinfo)
+{
+	int ret;
+	struct tlb_request req = {
+		.tinfo = tinfo,
+		.count = 1,
+		.queued = NULL,
+	};
+
+	ret = tlb_request_prepare(tinfo);
+	if (ret)
+		return ret;
 
 	sbi_pmu_ctr_incr_fw(tlb_type_to_pmu_fw_event[tinfo->type]);
 
-	return sbi_ipi_send_many(hmask, hbase, tlb_event, tinfo);
+	return sbi_ipi_send_many(hmask, hbase, tlb_event, &req);
+}
+
+int sbi_tlb_request_batch(ulong hmask, ulong hbase,
+			  struct sbi_tlb_info *tinfo, u32 count)
+{
+	int ret;
+	u32 i;
+	u16 queued[SBI_HARTMASK_MAX_BITS] = { 0 };
+	struct tlb_request req = {
+		.tinfo = tinfo,
+		.count = count,
+		.queued = queued,
+	};
+
+	if (!count)
+		return 0;
+	if (count > SBI_TLB_BATCH_MAX_ENTRIES)
+		return SBI_EINVAL;
+
+	for (i = 0; i < count; i++) {
+		ret = tlb_request_prepare(&tinfo[i]);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < count; i++)
+		sbi_pmu_ctr_incr_fw(tlb_type_to_pmu_fw_event[tinfo[i].type]);
+
+	return sbi_ipi_send_many(hmask, hbase, tlb_event, &req);
+}
+
+unsigned long sbi_tlb_range_flush_limit(struct sbi_scratch *scratch)
+{
+	struct tlb_hart_state *ths;
+
+	if (!scratch || !tlb_hart_off)
+		return 0;
+
+	ths = sbi_scratch_offset_ptr(scratch, tlb_hart_off);
+	return ths->flush_limit;
+}
+
+#ifdef CONFIG_SBI_TLB_FLUSH_LIMIT_CALIBRATE
+
+/* Number of pages flushed per calibration round */
+#define TLB_CALIBRATE_PAGES		64
+/* Number of calibration rounds, the fastest one is kept */
+#define TLB_CALIBRATE_ROUNDS		4
+/* Maximum number of HART classes remembered */
+#define TLB_CALIBRATE_CLASS_MAX		4
+
+/* Calibrated limit of HARTs sharing the same implementation */
+struct tlb_calibrate_class {
+	unsigned long marchid;
+	unsigned long mimpid;
+	unsigned long flush_limit;
+};
+
+static struct tlb_calibrate_class tlb_calibrate_classes[TLB_CALIBRATE_CLASS_MAX];
+static u32 tlb_calibrate_class_count;
+static spinlock_t tlb_calibrate_lock = SPIN_LOCK_INITIALIZER;
+
+/*
+ * Time the local flush engine of this HART on a range of pages and on a
+ * full flush. The limit is the range size for which both cost the same,
+ * the refill cost of a full flush is not accounted for so the result is
+ * a lower bound.
+ */
+static unsigned long tlb_flush_limit_measure(void)
+{
+	unsigned long t, per_page = -1UL, full = -1UL, pages;
+	struct tlb_hart_state *ths =
+			sbi_scratch_thishart_offset_ptr(tlb_hart_off);
+	struct sbi_tlb_info tinfo;
+	int i;
+
+	for (i = 0; i < TLB_CALIBRATE_ROUNDS; i++) {
+		SBI_TLB_INFO_INIT(&tinfo, 0, TLB_CALIBRATE_PAGES * PAGE_SIZE,
+				  0, 0, SBI_TLB_SFENCE_VMA, current_hartid());
+		t = csr_read(CSR_MCYCLE);
+		ths->engine[SBI_TLB_SFENCE_VMA](&tinfo);
+		t = csr_read(CSR_MCYCLE) - t;
+		if (t / TLB_CALIBRATE_PAGES < per_page)
+			per_page = t / TLB_CALIBRATE_PAGES;
+
+		tinfo.size = SBI_TLB_FLUSH_ALL;
+		t = csr_read(CSR_MCYCLE);
+		ths->engine[SBI_TLB_SFENCE_VMA](&tinfo);
+		t = csr_read(CSR_MCYCLE) - t;
+		if (t < full)
+			full = t;
+	}
+
+	if (!per_page)
+		return TLB_CALIBRATE_PAGES * PAGE_SIZE;
+
+	pages = full / per_page;
+	if (pages < 1)
+		pages = 1;
+	if (pages > TLB_CALIBRATE_PAGES)
+		pages = TLB_CALIBRATE_PAGES;
+
+	return pages * PAGE_SIZE;
+}
+
+static unsigned long tlb_flush_limit_calibrate(void)
+{
+	unsigned long marchid = csr_read(CSR_MARCHID);
+	unsigned long mimpid = csr_read(CSR_MIMPID);
+	struct tlb_calibrate_class *c;
+	unsigned long limit;
+	u32 i;
+
+	spin_lock(&tlb_calibrate_lock);
+
+	for (i = 0; i < tlb_calibrate_class_count; i++) {
+		c = &tlb_calibrate_classes[i];
+		if (c->marchid == marchid && c->mimpid == mimpid) {
+			limit = c->flush_limit;
+			goto done;
+		}
+	}
+
+	limit = tlb_flush_limit_measure();
+	if (tlb_calibrate_class_count < TLB_CALIBRATE_CLASS_MAX) {
+		c = &tlb_calibrate_classes[tlb_calibrate_class_count++];
+		c->marchid = marchid;
+		c->mimpid = mimpid;
+		c->flush_limit = limit;
+	}
+
+done:
+	spin_unlock(&tlb_calibrate_lock);
+	return limit;
+}
+
+#endif
+
+static unsigned long tlb_flush_limit_init(const struct sbi_platform *plat)
+{
+#ifdef CONFIG_SBI_TLB_FLUSH_LIMIT_CALIBRATE
+	/* A limit provided by the platform always takes precedence */
+	if (!sbi_platform_ops(plat)->get_tlbr_flush_limit)
+		return tlb_flush_limit_calibrate();
+#endif
+
+	return sbi_platform_tlbr_flush_limit(plat);
+}
+
+const struct sbi_tlb_stats *sbi_tlb_get_stats(u32 hartindex)
+{
+	struct sbi_scratch *scratch = sbi_hartindex_to_scratch(hartindex);
+
+	if (!scratch || !tlb_stats_off)
+		return NULL;
+
+	return sbi_scratch_offset_ptr(scratch, tlb_stats_off);
 }
 
 int sbi_tlb_init(struct sbi_scratch *scratch, bool cold_boot)
@@ -417,57 +883,84 @@ int sbi_tlb_init(struct sbi_scratch *scratch, bool cold_boot)
 	int ret;
 	void *tlb_mem;
 	atomic_t *tlb_sync;
-	struct sbi_fifo *tlb_q;
+	struct sbi_mpsc *tlb_q;
+	struct sbi_tlb_stats *stats;
+	struct tlb_hart_state *ths;
 	const struct sbi_platform *plat = sbi_platform_ptr(scratch);
+	u32 num_entries = sbi_platform_tlb_fifo_num_entries(plat);
 
 	if (cold_boot) {
 		tlb_sync_off = sbi_scratch_alloc_offset(sizeof(*tlb_sync));
 		if (!tlb_sync_off)
 			return SBI_ENOMEM;
-		tlb_fifo_off = sbi_scratch_alloc_offset(sizeof(*tlb_q));
-		if (!tlb_fifo_off) {
+		tlb_queue_off = sbi_scratch_alloc_offset(sizeof(*tlb_q));
+		if (!tlb_queue_off) {
 			sbi_scratch_free_offset(tlb_sync_off);
 			return SBI_ENOMEM;
 		}
-		tlb_fifo_mem_off = sbi_scratch_alloc_offset(sizeof(tlb_mem));
-		if (!tlb_fifo_mem_off) {
-			sbi_scratch_free_offset(tlb_fifo_off);
+		tlb_queue_mem_off = sbi_scratch_alloc_offset(sizeof(tlb_mem));
+		if (!tlb_queue_mem_off) {
+			sbi_scratch_free_offset(tlb_queue_off);
+			sbi_scratch_free_offset(tlb_sync_off);
+			return SBI_ENOMEM;
+		}
+		tlb_stats_off = sbi_scratch_alloc_offset(sizeof(*stats));
+		if (!tlb_stats_off) {
+			sbi_scratch_free_offset(tlb_queue_mem_off);
+			sbi_scratch_free_offset(tlb_queue_off);
+			sbi_scratch_free_offset(tlb_sync_off);
+			return SBI_ENOMEM;
+		}
+		tlb_hart_off = sbi_scratch_alloc_offset(sizeof(*ths));
+		if (!tlb_hart_off) {
+			sbi_scratch_free_offset(tlb_stats_off);
+			sbi_scratch_free_offset(tlb_queue_mem_off);
+			sbi_scratch_free_offset(tlb_queue_off);
 			sbi_scratch_free_offset(tlb_sync_off);
 			return SBI_ENOMEM;
 		}
 		ret = sbi_ipi_event_create(&tlb_ops);
 		if (ret < 0) {
-			sbi_scratch_free_offset(tlb_fifo_mem_off);
-			sbi_scratch_free_offset(tlb_fifo_off);
+			sbi_scratch_free_offset(tlb_hart_off);
+			sbi_scratch_free_offset(tlb_stats_off);
+			sbi_scratch_free_offset(tlb_queue_mem_off);
+			sbi_scratch_free_offset(tlb_queue_off);
 			sbi_scratch_free_offset(tlb_sync_off);
 			return ret;
 		}
 		tlb_event = ret;
-		tlb_range_flush_limit = sbi_platform_tlbr_flush_limit(plat);
 	} else {
 		if (!tlb_sync_off ||
-		    !tlb_fifo_off ||
-		    !tlb_fifo_mem_off)
+		    !tlb_queue_off ||
+		    !tlb_queue_mem_off ||
+		    !tlb_stats_off ||
+		    !tlb_hart_off)
 			return SBI_ENOMEM;
 		if (SBI_IPI_EVENT_MAX <= tlb_event)
 			return SBI_ENOSPC;
 	}
 
 	tlb_sync = sbi_scratch_offset_ptr(scratch, tlb_sync_off);
-	tlb_q = sbi_scratch_offset_ptr(scratch, tlb_fifo_off);
-	tlb_mem = sbi_scratch_read_type(scratch, void *, tlb_fifo_mem_off);
+	tlb_q = sbi_scratch_offset_ptr(scratch, tlb_queue_off);
+	stats = sbi_scratch_offset_ptr(scratch, tlb_stats_off);
+	tlb_mem = sbi_scratch_read_type(scratch, void *, tlb_queue_mem_off);
 	if (!tlb_mem) {
-		tlb_mem = sbi_malloc(
-				sbi_platform_tlb_fifo_num_entries(plat) * SBI_TLB_INFO_SIZE);
+		tlb_mem = sbi_malloc(sbi_mpsc_mem_size(num_entries,
+						       SBI_TLB_INFO_SIZE));
 		if (!tlb_mem)
 			return SBI_ENOMEM;
-		sbi_scratch_write_type(scratch, void *, tlb_fifo_mem_off, tlb_mem);
+		sbi_scratch_write_type(scratch, void *, tlb_queue_mem_off, tlb_mem);
 	}
 
-	ATOMIC_INIT(tlb_sync, 0);
+	ths = sbi_scratch_offset_ptr(scratch, tlb_hart_off);
+	if (sbi_hart_has_extension(scratch, SBI_HART_EXT_SVINVAL))
+		ths->engine = tlb_svinval_engine;
+	else
+		ths->engine = tlb_fence_engine;
+	ths->flush_limit = tlb_flush_limit_init(plat);
 
-	sbi_fifo_init(tlb_q, tlb_mem,
-		      sbi_platform_tlb_fifo_num_entries(plat), SBI_TLB_INFO_SIZE);
+	ATOMIC_INIT(tlb_sync, 0);
+	sbi_memset(stats, 0, sizeof(*stats));
 
-	return 0;
+	return sbi_mpsc_init(tlb_q, tlb_mem, num_entries, SBI_TLB_INFO_SIZE);
 }
@@ -25,6 +25,8 @@
 #include <sbi/sbi_sse.h>
 #include <sbi/sbi_timer.h>
 #include <sbi/sbi_trap.h>
+#include <sbi/sbi_trap_hist.h>
+#include <sbi/sbi_hotpc.h>
 
 static void sbi_trap_error_one(const struct sbi_trap_context *tcntx,
 			       const char *prefix, u32 hartid, u32 depth)
@@ -286,6 +288,16 @@ static int sbi_trap_aia_irq(void)
 	return 0;
 }
 
+/*
+ * Emulated instructions resume right after the trapping instruction
+ * while traps redirected to S-mode resume at its trap vector.
+ */
+static inline bool sbi_trap_emulated(const struct sbi_trap_regs *regs,
+				     unsigned long epc)
+{
+	return regs->mepc == epc + 2 || regs->mepc == epc + 4;
+}
+
 /**
  * Handle trap/interrupt
  *
@@ -310,6 +322,8 @@ struct sbi_trap_context *sbi_trap_handler(struct sbi_trap_context *tcntx)
 	const struct sbi_trap_info *trap = &tcntx->trap;
 	struct sbi_trap_regs *regs = &tcntx->regs;
 	ulong mcause = tcntx->trap.cause;
+	unsigned long hist_start = sbi_trap_hist_start();
+	unsigned long epc = regs->mepc, emul_start;
 
 	/* Update trap context pointer */
 	tcntx->prev_context = sbi_trap_get_context(scratch);
@@ -327,18 +341,27 @@ struct sbi_trap_context *sbi_trap_handler(struct sbi_trap_context *tcntx)
 
 	switch (mcause) {
 	case CAUSE_ILLEGAL_INSTRUCTION:
+		emul_start = sbi_hotpc_start();
 		rc  = sbi_illegal_insn_handler(tcntx);
 		msg = "illegal instruction handler failed";
+		if (sbi_trap_emulated(regs, epc))
+			sbi_hotpc_record(SBI_HOTPC_ILLEGAL_INSN, epc, emul_start);
 		break;
 	case CAUSE_MISALIGNED_LOAD:
 		sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_LOAD);
+		emul_start = sbi_hotpc_start();
 		rc  = sbi_misaligned_load_handler(tcntx);
 		msg = "misaligned load handler failed";
+		if (sbi_trap_emulated(regs, epc))
+			sbi_hotpc_record(SBI_HOTPC_MISALIGNED_LOAD, epc, emul_start);
 		break;
 	case CAUSE_MISALIGNED_STORE:
 		sbi_pmu_ctr_incr_fw(SBI_PMU_FW_MISALIGNED_STORE);
+		emul_start = sbi_hotpc_start();
 		rc  = sbi_misaligned_store_handler(tcntx);
 		msg = "misaligned store handler failed";
+		if (sbi_trap_emulated(regs, epc))
+			sbi_hotpc_record(SBI_HOTPC_MISALIGNED_STORE, epc, emul_start);
 		break;
 	case CAUSE_SUPERVISOR_ECALL:
 	case CAUSE_MACHINE_ECALL:
@@ -374,6 +397,7 @@ trap_done:
 		sbi_sse_process_pending_events(regs);
 
 	sbi_trap_set_context(scratch, tcntx->prev_context);
+	sbi_trap_hist_trap(mcause, hist_start);
 	return tcntx;
 }
 
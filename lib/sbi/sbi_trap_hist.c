@@ -0,0 +1,50 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sbi/riscv_encoding.h>
+#include <sbi/sbi_bitops.h>
+#include <sbi/sbi_pmu.h>
+#include <sbi/sbi_trap_hist.h>
+
+/*
+ * The latency samples are only accounted in the OpenSBI internal PMU
+ * firmware counters, so S-mode builds the histograms it is interested
+ * in by starting one counter per bucket and trap cause or EID/FID.
+ */
+
+static inline u32 trap_hist_bucket(unsigned long start)
+{
+	unsigned long cycles = csr_read(CSR_MCYCLE) - start;
+	u32 bucket;
+
+	cycles >>= SBI_TRAP_HIST_BUCKET_SHIFT;
+	if (!cycles)
+		return 0;
+
+	bucket = sbi_fls(cycles) + 1;
+	return (bucket < SBI_TRAP_HIST_BUCKETS) ?
+		bucket : SBI_TRAP_HIST_BUCKETS - 1;
+}
+
+void sbi_trap_hist_trap(unsigned long mcause, unsigned long start)
+{
+	u32 key;
+
+	if (mcause & MCAUSE_IRQ_MASK)
+		key = BIT(15) | (mcause & 0x7fff);
+	else
+		key = mcause & 0x7fff;
+
+	sbi_pmu_ctr_add_fw_internal(SBI_PMU_FW_INTERNAL_LATENCY_DATA(
+			SBI_PMU_FW_INTERNAL_TRAP_LATENCY,
+			trap_hist_bucket(start), key, 0), 1);
+}
+
+void sbi_trap_hist_ecall(unsigned long extid, unsigned long funcid,
+			 unsigned long start)
+{
+	sbi_pmu_ctr_add_fw_internal(SBI_PMU_FW_INTERNAL_LATENCY_DATA(
+			SBI_PMU_FW_INTERNAL_ECALL_LATENCY,
+			trap_hist_bucket(start), funcid, (u32)extid), 1);
+}
@@ -25,6 +25,18 @@ libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_bitops_test.o
 carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += string_test_suite
 libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_string_test.o
 
+carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += mpsc_test_suite
+libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_mpsc_test.o
+
+carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += heap_test_suite
+libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_heap_test.o
+
+carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += minheap_test_suite
+libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_minheap_test.o
+
+carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += timer_test_suite
+libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_timer_test.o
+
 ifeq ($(UBSAN),y)
 carray-sbi_unit_tests-$(CONFIG_SBIUNIT) += ubsan_test_suite
 libsbi-objs-$(CONFIG_SBIUNIT) += tests/sbi_ubsan_test.o
@@ -40,10 +40,34 @@ static void test_sbi_ecall_register_find_extension(struct sbiunit_test_case *tes
 	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START), NULL);
 }
 
+static void test_sbi_ecall_find_extension_range(struct sbiunit_test_case *test)
+{
+	struct sbi_ecall_extension test_ext = {
+		.extid_start = SBI_EXT_EXPERIMENTAL_START + 0x10,
+		.extid_end = SBI_EXT_EXPERIMENTAL_START + 0x1f,
+		.name = "TestRng",
+		.handle = dummy_handler,
+	};
+
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_register_extension(&test_ext), 0);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x10), &test_ext);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x18), &test_ext);
+	/* Second lookup of the same ID */
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x18), &test_ext);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x1f), &test_ext);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x20), NULL);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x0f), NULL);
+	SBIUNIT_EXPECT_NE(test, sbi_ecall_find_extension(SBI_EXT_BASE), NULL);
+
+	sbi_ecall_unregister_extension(&test_ext);
+	SBIUNIT_EXPECT_EQ(test, sbi_ecall_find_extension(SBI_EXT_EXPERIMENTAL_START + 0x18), NULL);
+}
+
 static struct sbiunit_test_case ecall_tests[] = {
 	SBIUNIT_TEST_CASE(test_sbi_ecall_version),
 	SBIUNIT_TEST_CASE(test_sbi_ecall_impid),
 	SBIUNIT_TEST_CASE(test_sbi_ecall_register_find_extension),
+	SBIUNIT_TEST_CASE(test_sbi_ecall_find_extension_range),
 	SBIUNIT_END_CASE,
 };
 
@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <sbi/sbi_heap.h>
+#include <sbi/sbi_unit_test.h>
+
+#define TEST_HEAP_SIZE		(16 * 1024)
+#define TEST_HEAP_OBJS		32
+
+static u8 test_heap_mem[TEST_HEAP_SIZE] __aligned(HEAP_BASE_ALIGN);
+
+static struct sbi_heap_control *test_heap_new(struct sbiunit_test_case *test)
+{
+	struct sbi_heap_control *hpctrl;
+
+	SBIUNIT_ASSERT_EQ(test, sbi_heap_alloc_new(&hpctrl), 0);
+	SBIUNIT_ASSERT_NE(test, hpctrl, NULL);
+	SBIUNIT_ASSERT_EQ(test, sbi_heap_init_new(hpctrl,
+						  (unsigned long)test_heap_mem,
+						  TEST_HEAP_SIZE), 0);
+
+	return hpctrl;
+}
+
+static unsigned long test_heap_total(struct sbi_heap_control *hpctrl)
+{
+	return sbi_heap_free_space_from(hpctrl) +
+	       sbi_heap_reserved_space_from(hpctrl);
+}
+
+static void heap_small_reuse_test(struct sbiunit_test_case *test)
+{
+	struct sbi_heap_control *hpctrl = test_heap_new(test);
+	void *p, *q;
+
+	p = sbi_malloc_from(hpctrl, 24);
+	SBIUNIT_ASSERT_NE(test, p, NULL);
+	SBIUNIT_EXPECT_EQ(test, (unsigned long)p & 63, 0);
+
+	/* A freed object is handed out again for the same size class */
+	sbi_free_from(hpctrl, p);
+	q = sbi_malloc_from(hpctrl, 64);
+	SBIUNIT_EXPECT_EQ(test, p, q);
+	sbi_free_from(hpctrl, q);
+
+	sbi_free(hpctrl);
+}
+
+static void heap_small_align_test(struct sbiunit_test_case *test)
+{
+	struct sbi_heap_control *hpctrl = test_heap_new(test);
+	void *p, *q, *r;
+
+	p = sbi_malloc_from(hpctrl, 100);
+	q = sbi_aligned_alloc_from(hpctrl, 256, 256);
+	r = sbi_aligned_alloc_from(hpctrl, 128, 128);
+	SBIUNIT_ASSERT(test, p && q && r);
+	SBIUNIT_EXPECT_EQ(test, (unsigned long)p & 63, 0);
+	SBIUNIT_EXPECT_EQ(test, (unsigned long)q & 255, 0);
+	SBIUNIT_EXPECT_EQ(test, (unsigned long)r & 127, 0);
+	SBIUNIT_EXPECT_NE(test, p, r);
+
+	sbi_free_from(hpctrl, p);
+	sbi_free_from(hpctrl, q);
+	sbi_free_from(hpctrl, r);
+
+	sbi_free(hpctrl);
+}
+
+static void heap_space_round(struct sbiunit_test_case *test,
+			     struct sbi_heap_control *hpctrl)
+{
+	void *objs[TEST_HEAP_OBJS], *big;
+	int i;
+
+	/* Spill over several slabs of the larger size classes */
+	for (i = 0; i < TEST_HEAP_OBJS; i++) {
+		objs[i] = sbi_malloc_from(hpctrl, 16 + (i % 4) * 80);
+		SBIUNIT_EXPECT_NE(test, objs[i], NULL);
+	}
+	big = sbi_malloc_from(hpctrl, 1024);
+	SBIUNIT_EXPECT_NE(test, big, NULL);
+
+	for (i = 0; i < TEST_HEAP_OBJS; i += 2)
+		sbi_free_from(hpctrl, objs[i]);
+	sbi_free_from(hpctrl, big);
+	for (i = 1; i < TEST_HEAP_OBJS; i += 2)
+		sbi_free_from(hpctrl, objs[i]);
+}
+
+static void heap_space_test(struct sbiunit_test_case *test)
+{
+	struct sbi_heap_control *hpctrl = test_heap_new(test);
+	unsigned long total = test_heap_total(hpctrl), free_space;
+
+	heap_space_round(test, hpctrl);
+	SBIUNIT_EXPECT_EQ(test, test_heap_total(hpctrl), total);
+	free_space = sbi_heap_free_space_from(hpctrl);
+
+	/* Nothing is lost when the same pattern is repeated */
+	heap_space_round(test, hpctrl);
+	SBIUNIT_EXPECT_EQ(test, test_heap_total(hpctrl), total);
+	SBIUNIT_EXPECT_EQ(test, sbi_heap_free_space_from(hpctrl), free_space);
+
+	sbi_free(hpctrl);
+}
+
+static void heap_coalesce_test(struct sbiunit_test_case *test)
+{
+	struct sbi_heap_control *hpctrl = test_heap_new(test);
+	void *plain[4], *aligned[4], *big;
+	unsigned long free_space;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		plain[i] = sbi_malloc_from(hpctrl, 320);
+		aligned[i] = sbi_aligned_alloc_from(hpctrl, 1024, 1024);
+		SBIUNIT_ASSERT(test, plain[i] && aligned[i]);
+		SBIUNIT_EXPECT_EQ(test, (unsigned long)aligned[i] & 1023, 0);
+	}
+
+	/* Free in an order which needs merging on both sides */
+	for (i = 0; i < 4; i += 2) {
+		sbi_free_from(hpctrl, plain[i]);
+		sbi_free_from(hpctrl, aligned[i + 1]);
+	}
+	for (i = 0; i < 4; i += 2) {
+		sbi_free_from(hpctrl, aligned[i]);
+		sbi_free_from(hpctrl, plain[i + 1]);
+	}
+
+	free_space = sbi_heap_free_space_from(hpctrl);
+	big = sbi_malloc_from(hpctrl, free_space / 2);
+	SBIUNIT_EXPECT_NE(test, big, NULL);
+	sbi_free_from(hpctrl, big);
+	SBIUNIT_EXPECT_EQ(test, sbi_heap_free_space_from(hpctrl), free_space);
+
+	sbi_free(hpctrl);
+}
+
+static struct sbiunit_test_case heap_test_cases[] = {
+	SBIUNIT_TEST_CASE(heap_small_reuse_test),
+	SBIUNIT_TEST_CASE(heap_small_align_test),
+	SBIUNIT_TEST_CASE(heap_space_test),
+	SBIUNIT_TEST_CASE(heap_coalesce_test),
+	SBIUNIT_END_CASE,
+};
+
+SBIUNIT_TEST_SUITE(heap_test_suite, heap_test_cases);
@@ -0,0 +1,126 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <sbi/sbi_minheap.h>
+#include <sbi/sbi_unit_test.h>
+
+#define TEST_MINHEAP_NODES	32
+
+static struct sbi_minheap_node test_nodes[TEST_MINHEAP_NODES];
+
+/* Keys in a scrambled but deterministic order, with duplicates */
+static u64 test_key(unsigned long i)
+{
+	return (i * 7) % (TEST_MINHEAP_NODES / 2);
+}
+
+/* Check parent links and heap order, return the number of nodes */
+static unsigned long minheap_check(struct sbi_minheap_node *node,
+				   struct sbi_minheap_node *parent, bool *ok)
+{
+	if (!node)
+		return 0;
+
+	if (node->parent != parent || (parent && parent->key > node->key))
+		*ok = false;
+
+	return 1 + minheap_check(node->left, node, ok) +
+		minheap_check(node->right, node, ok);
+}
+
+static bool minheap_valid(struct sbi_minheap *h)
+{
+	bool ok = true;
+
+	return minheap_check(h->root, NULL, &ok) == h->count && ok;
+}
+
+static void minheap_fill(struct sbi_minheap *h)
+{
+	unsigned long i;
+
+	SBI_INIT_MINHEAP(h);
+	for (i = 0; i < TEST_MINHEAP_NODES; i++) {
+		SBI_INIT_MINHEAP_NODE(&test_nodes[i]);
+		test_nodes[i].key = test_key(i);
+		sbi_minheap_insert(h, &test_nodes[i]);
+	}
+}
+
+static void minheap_order_test(struct sbiunit_test_case *test)
+{
+	struct sbi_minheap_node *node;
+	struct sbi_minheap h;
+	u64 last = 0;
+
+	SBI_INIT_MINHEAP(&h);
+	SBIUNIT_EXPECT(test, sbi_minheap_empty(&h));
+	SBIUNIT_EXPECT_EQ(test, sbi_minheap_first(&h), NULL);
+
+	minheap_fill(&h);
+	SBIUNIT_EXPECT_EQ(test, h.count, TEST_MINHEAP_NODES);
+	SBIUNIT_ASSERT(test, minheap_valid(&h));
+
+	/* Nodes come out in ascending key order */
+	while ((node = sbi_minheap_first(&h))) {
+		SBIUNIT_EXPECT(test, last <= node->key);
+		last = node->key;
+		sbi_minheap_remove(&h, node);
+		SBIUNIT_ASSERT(test, minheap_valid(&h));
+	}
+	SBIUNIT_EXPECT_EQ(test, h.count, 0);
+	SBIUNIT_EXPECT(test, sbi_minheap_empty(&h));
+}
+
+static void minheap_remove_test(struct sbiunit_test_case *test)
+{
+	struct sbi_minheap h;
+	unsigned long i;
+
+	minheap_fill(&h);
+
+	/* Remove interior nodes and leaves, then the root */
+	for (i = 1; i < TEST_MINHEAP_NODES; i += 3) {
+		sbi_minheap_remove(&h, &test_nodes[i]);
+		SBIUNIT_ASSERT(test, minheap_valid(&h));
+		SBIUNIT_EXPECT_EQ(test, test_nodes[i].parent, NULL);
+	}
+	sbi_minheap_remove(&h, sbi_minheap_first(&h));
+	SBIUNIT_ASSERT(test, minheap_valid(&h));
+
+	/* The removed nodes can be inserted again */
+	for (i = 1; i < TEST_MINHEAP_NODES; i += 3) {
+		sbi_minheap_insert(&h, &test_nodes[i]);
+		SBIUNIT_ASSERT(test, minheap_valid(&h));
+	}
+	SBIUNIT_EXPECT_EQ(test, h.count, TEST_MINHEAP_NODES - 1);
+}
+
+static void minheap_update_test(struct sbiunit_test_case *test)
+{
+	struct sbi_minheap h;
+	unsigned long i;
+
+	minheap_fill(&h);
+
+	/* Move a node to the front and then to the back */
+	sbi_minheap_update(&h, &test_nodes[5], 0);
+	SBIUNIT_EXPECT_EQ(test, sbi_minheap_first(&h)->key, 0);
+	SBIUNIT_ASSERT(test, minheap_valid(&h));
+
+	for (i = 0; i < TEST_MINHEAP_NODES; i++) {
+		if (test_nodes[i].key == 0)
+			sbi_minheap_update(&h, &test_nodes[i], 100 + i);
+		SBIUNIT_ASSERT(test, minheap_valid(&h));
+	}
+	SBIUNIT_EXPECT_EQ(test, sbi_minheap_first(&h)->key, 1);
+}
+
+static struct sbiunit_test_case minheap_test_cases[] = {
+	SBIUNIT_TEST_CASE(minheap_order_test),
+	SBIUNIT_TEST_CASE(minheap_remove_test),
+	SBIUNIT_TEST_CASE(minheap_update_test),
+	SBIUNIT_END_CASE,
+};
+
+SBIUNIT_TEST_SUITE(minheap_test_suite, minheap_test_cases);
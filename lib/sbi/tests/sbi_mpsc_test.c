@@ -0,0 +1,82 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <sbi/sbi_error.h>
+#include <sbi/sbi_mpsc.h>
+#include <sbi/sbi_unit_test.h>
+
+#define TEST_MPSC_ENTRIES	4
+
+static unsigned long test_mpsc_mem[TEST_MPSC_ENTRIES * 2];
+
+static void mpsc_init_test(struct sbiunit_test_case *test)
+{
+	struct sbi_mpsc q;
+
+	SBIUNIT_EXPECT_EQ(test, sbi_mpsc_mem_size(3, sizeof(unsigned long)),
+			  sizeof(test_mpsc_mem));
+	SBIUNIT_EXPECT_EQ(test, sbi_mpsc_init(&q, NULL, 4, 8), SBI_EINVAL);
+	SBIUNIT_EXPECT_EQ(test, sbi_mpsc_init(&q, test_mpsc_mem, 0, 8),
+			  SBI_EINVAL);
+
+	/* Entry count is rounded up to a power of two */
+	SBIUNIT_ASSERT_EQ(test, sbi_mpsc_init(&q, test_mpsc_mem, 3,
+					      sizeof(unsigned long)), 0);
+	SBIUNIT_EXPECT_EQ(test, q.num_entries, TEST_MPSC_ENTRIES);
+	SBIUNIT_EXPECT(test, sbi_mpsc_is_empty(&q));
+}
+
+static void mpsc_full_empty_test(struct sbiunit_test_case *test)
+{
+	struct sbi_mpsc q;
+	unsigned long i, val;
+
+	SBIUNIT_ASSERT_EQ(test, sbi_mpsc_init(&q, test_mpsc_mem,
+					      TEST_MPSC_ENTRIES,
+					      sizeof(unsigned long)), 0);
+
+	SBIUNIT_EXPECT_EQ(test, sbi_mpsc_dequeue(&q, &val), SBI_ENOENT);
+
+	for (i = 0; i < TEST_MPSC_ENTRIES; i++) {
+		SBIUNIT_EXPECT(test, !sbi_mpsc_is_full(&q));
+		SBIUNIT_EXPECT_EQ(test, sbi_mpsc_enqueue(&q, &i), 0);
+	}
+	SBIUNIT_EXPECT(test, sbi_mpsc_is_full(&q));
+	SBIUNIT_EXPECT_EQ(test, sbi_mpsc_enqueue(&q, &i), SBI_ENOSPC);
+	SBIUNIT_EXPECT(test, !sbi_mpsc_is_empty(&q));
+
+	for (i = 0; i < TEST_MPSC_ENTRIES; i++) {
+		SBIUNIT_EXPECT_EQ(test, sbi_mpsc_dequeue(&q, &val), 0);
+		SBIUNIT_EXPECT_EQ(test, val, i);
+		SBIUNIT_EXPECT(test, !sbi_mpsc_is_full(&q));
+	}
+	SBIUNIT_EXPECT(test, sbi_mpsc_is_empty(&q));
+}
+
+static void mpsc_wrap_test(struct sbiunit_test_case *test)
+{
+	struct sbi_mpsc q;
+	unsigned long i, val;
+
+	SBIUNIT_ASSERT_EQ(test, sbi_mpsc_init(&q, test_mpsc_mem,
+					      TEST_MPSC_ENTRIES,
+					      sizeof(unsigned long)), 0);
+
+	/* Keep the queue half full across several laps */
+	for (i = 0; i < 2; i++)
+		SBIUNIT_EXPECT_EQ(test, sbi_mpsc_enqueue(&q, &i), 0);
+	for (i = 2; i < 5 * TEST_MPSC_ENTRIES; i++) {
+		SBIUNIT_EXPECT_EQ(test, sbi_mpsc_enqueue(&q, &i), 0);
+		SBIUNIT_EXPECT_EQ(test, sbi_mpsc_dequeue(&q, &val), 0);
+		SBIUNIT_EXPECT_EQ(test, val, i - 2);
+	}
+}
+
+static struct sbiunit_test_case mpsc_test_cases[] = {
+	SBIUNIT_TEST_CASE(mpsc_init_test),
+	SBIUNIT_TEST_CASE(mpsc_full_empty_test),
+	SBIUNIT_TEST_CASE(mpsc_wrap_test),
+	SBIUNIT_END_CASE,
+};
+
+SBIUNIT_TEST_SUITE(mpsc_test_suite, mpsc_test_cases);
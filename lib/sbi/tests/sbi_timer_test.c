@@ -0,0 +1,176 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <sbi/sbi_scratch.h>
+#include <sbi/sbi_timer.h>
+#include <sbi/sbi_timer_test.h>
+#include <sbi/sbi_unit_test.h>
+
+static void test_timer_event_callback(struct sbi_timer_event *ev,
+				      struct sbi_timer_event_restart *restart)
+{
+	(*(u32 *)ev->priv)++;
+}
+
+/*
+ * A request pushed after the owner processed its inbox but before it
+ * published its next head sees a stale expired head and sends no IPI,
+ * so the owner has to find it when publishing the head.
+ */
+static void timer_inbox_race_test(struct sbiunit_test_case *test)
+{
+	struct timer_state *tstate = sbi_timer_test_state_alloc();
+	int hart_index = current_hartindex();
+	struct sbi_timer_event e1, e2;
+	u32 fired = 0;
+
+	SBIUNIT_ASSERT(test, tstate);
+	SBI_INIT_TIMER_EVENT(&e1, test_timer_event_callback, NULL, &fired);
+	SBI_INIT_TIMER_EVENT(&e2, test_timer_event_callback, NULL, &fired);
+
+	/* e1 is about to fire and was the head last published */
+	sbi_timer_test_event_start(tstate, &e1, 100);
+	sbi_timer_test_update_head(tstate);
+
+	/* Another HART hands e2 over, later than the published head */
+	sbi_timer_test_request(&e2, 200, hart_index);
+	e2.hart_index = hart_index;
+	sbi_timer_test_push(tstate, &e2);
+	SBIUNIT_EXPECT(test, !(200 < sbi_timer_test_head(tstate)));
+
+	/* The owner fires e1 and publishes its next head */
+	sbi_timer_test_event_stop(tstate, &e1);
+	sbi_timer_test_update_head(tstate);
+
+	SBIUNIT_EXPECT(test, !sbi_timer_test_pending(tstate));
+	SBIUNIT_EXPECT_EQ(test, atomic_read(&e2.inbox_busy), 0);
+	SBIUNIT_EXPECT(test, sbi_timer_test_queued(tstate, &e2));
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), 200);
+
+	sbi_timer_test_process(tstate, 200);
+	SBIUNIT_EXPECT_EQ(test, fired, 1);
+	SBIUNIT_EXPECT_EQ(test, e2.hart_index, -1);
+
+	sbi_timer_test_state_free(tstate);
+}
+
+/*
+ * An expired event with a request in flight is dropped by the owner
+ * without firing, the request which is pushed afterwards requeues it.
+ */
+static void timer_inbox_inflight_test(struct sbiunit_test_case *test)
+{
+	struct timer_state *tstate = sbi_timer_test_state_alloc();
+	int hart_index = current_hartindex();
+	struct sbi_timer_event ev;
+	u32 fired = 0;
+
+	SBIUNIT_ASSERT(test, tstate);
+	SBI_INIT_TIMER_EVENT(&ev, test_timer_event_callback, NULL, &fired);
+
+	sbi_timer_test_event_start(tstate, &ev, 100);
+
+	/* Another HART takes the event before it fires */
+	sbi_timer_test_request(&ev, 300, hart_index);
+	sbi_timer_test_process(tstate, 100);
+	SBIUNIT_EXPECT_EQ(test, fired, 0);
+	SBIUNIT_EXPECT(test, !sbi_timer_test_queued(tstate, &ev));
+
+	sbi_timer_test_push(tstate, &ev);
+	SBIUNIT_EXPECT(test, sbi_timer_test_pending(tstate));
+
+	sbi_timer_test_process(tstate, 100);
+	SBIUNIT_EXPECT_EQ(test, atomic_read(&ev.inbox_busy), 0);
+	SBIUNIT_EXPECT(test, sbi_timer_test_queued(tstate, &ev));
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), 300);
+	SBIUNIT_EXPECT_EQ(test, fired, 0);
+
+	sbi_timer_test_process(tstate, 300);
+	SBIUNIT_EXPECT_EQ(test, fired, 1);
+	SBIUNIT_EXPECT_EQ(test, ev.hart_index, -1);
+
+	sbi_timer_test_state_free(tstate);
+}
+
+/* A stop request from another HART takes the event off the owner */
+static void timer_inbox_stop_test(struct sbiunit_test_case *test)
+{
+	struct timer_state *tstate = sbi_timer_test_state_alloc();
+	struct sbi_timer_event ev;
+	u32 fired = 0;
+
+	SBIUNIT_ASSERT(test, tstate);
+	SBI_INIT_TIMER_EVENT(&ev, test_timer_event_callback, NULL, &fired);
+
+	sbi_timer_test_event_start(tstate, &ev, 1000);
+	SBIUNIT_ASSERT(test, sbi_timer_test_queued(tstate, &ev));
+
+	sbi_timer_test_request(&ev, 0, -1);
+	sbi_timer_test_push(tstate, &ev);
+	sbi_timer_test_process(tstate, 0);
+
+	SBIUNIT_EXPECT(test, !sbi_timer_test_pending(tstate));
+	SBIUNIT_EXPECT_EQ(test, atomic_read(&ev.inbox_busy), 0);
+	SBIUNIT_EXPECT_EQ(test, ev.hart_index, -1);
+	SBIUNIT_EXPECT(test, !sbi_timer_test_queued(tstate, &ev));
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), -1ULL);
+	SBIUNIT_EXPECT_EQ(test, fired, 0);
+
+	sbi_timer_test_state_free(tstate);
+}
+
+/* Events whose windows have opened share the interrupt of the first */
+static void timer_slack_test(struct sbiunit_test_case *test)
+{
+	struct timer_state *tstate = sbi_timer_test_state_alloc();
+	struct sbi_timer_event e1, e2, e3, e4;
+	u32 fired1 = 0, fired2 = 0, fired3 = 0, fired4 = 0;
+
+	SBIUNIT_ASSERT(test, tstate);
+	SBI_INIT_TIMER_EVENT(&e1, test_timer_event_callback, NULL, &fired1);
+	SBI_INIT_TIMER_EVENT(&e2, test_timer_event_callback, NULL, &fired2);
+	SBI_INIT_TIMER_EVENT(&e3, test_timer_event_callback, NULL, &fired3);
+	SBI_INIT_TIMER_EVENT(&e4, test_timer_event_callback, NULL, &fired4);
+
+	/* e1 and e2 expire within the windows of each other */
+	e1.slack = 50;
+	e2.slack = 50;
+	sbi_timer_test_event_start(tstate, &e1, 100);
+	sbi_timer_test_event_start(tstate, &e2, 120);
+	sbi_timer_test_event_start(tstate, &e3, 400);
+	sbi_timer_test_update_head(tstate);
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), 150);
+
+	/* One pass at the latest expiry of e1 delivers both */
+	sbi_timer_test_process(tstate, 150);
+	SBIUNIT_EXPECT_EQ(test, fired1, 1);
+	SBIUNIT_EXPECT_EQ(test, fired2, 1);
+	SBIUNIT_EXPECT_EQ(test, fired3, 0);
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), 400);
+
+	/* The latest expiry of e4 saturates */
+	e4.slack = -1ULL - 5;
+	sbi_timer_test_event_start(tstate, &e4, 160);
+	sbi_timer_test_event_stop(tstate, &e3);
+
+	/* e4 is not due before the time stamp it was started for */
+	sbi_timer_test_process(tstate, 155);
+	SBIUNIT_EXPECT_EQ(test, fired4, 0);
+	SBIUNIT_EXPECT_EQ(test, sbi_timer_test_head(tstate), -1ULL);
+
+	sbi_timer_test_process(tstate, 160);
+	SBIUNIT_EXPECT_EQ(test, fired4, 1);
+	SBIUNIT_EXPECT_EQ(test, fired3, 0);
+
+	sbi_timer_test_state_free(tstate);
+}
+
+static struct sbiunit_test_case timer_test_cases[] = {
+	SBIUNIT_TEST_CASE(timer_inbox_race_test),
+	SBIUNIT_TEST_CASE(timer_inbox_inflight_test),
+	SBIUNIT_TEST_CASE(timer_inbox_stop_test),
+	SBIUNIT_TEST_CASE(timer_slack_test),
+	SBIUNIT_END_CASE,
+};
+
+SBIUNIT_TEST_SUITE(timer_test_suite, timer_test_cases);
@@ -491,6 +491,13 @@ static int fdt_parse_uart_node_common(const void *fdt, int nodeoffset,
 	else
 		uart->baud = default_baud;
 
+	/* Transmit FIFO depth, zero lets the driver pick or probe it */
+	val = (fdt32_t *)fdt_getprop(fdt, nodeoffset, "fifo-size", &len);
+	if (len > 0 && val)
+		uart->fifo_size = fdt32_to_cpu(*val);
+	else
+		uart->fifo_size = 0;
+
 	return 0;
 }
 
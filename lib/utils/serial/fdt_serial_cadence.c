@@ -20,7 +20,8 @@ static int serial_cadence_init(const void *fdt, int nodeoff,
 	if (rc)
 		return rc;
 
-	return cadence_uart_init(uart.addr, uart.freq, uart.baud);
+	return cadence_uart_init(uart.addr, uart.freq, uart.baud,
+				 uart.fifo_size);
 }
 
 static const struct fdt_match serial_cadence_match[] = {
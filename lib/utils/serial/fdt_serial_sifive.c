@@ -21,7 +21,8 @@ static int serial_sifive_init(const void *fdt, int nodeoff,
 	if (rc)
 		return rc;
 
-	return sifive_uart_init(uart.addr, uart.freq, uart.baud);
+	return sifive_uart_init(uart.addr, uart.freq, uart.baud,
+				uart.fifo_size);
 }
 
 static const struct fdt_match serial_sifive_match[] = {
@@ -26,13 +26,19 @@
 #define UART_RXFIFO_EMPTY	0x80000000
 #define UART_RXFIFO_DATA	0x000000ff
 #define UART_TXCTRL_TXEN	0x1
+#define UART_TXCTRL_TXCNT_SHIFT	16
 #define UART_RXCTRL_RXEN	0x1
+#define UART_IP_TXWM		0x1
+
+/* Transmit FIFO depth of the SiFive UART */
+#define UART_TXFIFO_SIZE	8
 
 /* clang-format on */
 
 static volatile char *uart_base;
 static u32 uart_in_freq;
 static u32 uart_baudrate;
+static u32 uart_fifo_size;
 
 /**
  * Find minimum divisor divides in_freq to max_target_hz;
@@ -75,6 +81,33 @@ static void sifive_uart_putc(char ch)
 	set_reg(UART_REG_TXFIFO, ch);
 }
 
+static unsigned long sifive_uart_puts(const char *str, unsigned long len)
+{
+	unsigned long i = 0;
+	bool cr_sent = false;
+	u32 room;
+	char ch;
+
+	while (i < len) {
+		/* The watermark is set up to signal an empty transmit FIFO */
+		while (!(get_reg(UART_REG_IP) & UART_IP_TXWM))
+			;
+
+		for (room = uart_fifo_size; room && i < len; room--) {
+			if (str[i] == '\n' && !cr_sent) {
+				ch = '\r';
+				cr_sent = true;
+			} else {
+				ch = str[i++];
+				cr_sent = false;
+			}
+			set_reg(UART_REG_TXFIFO, ch);
+		}
+	}
+
+	return len;
+}
+
 static int sifive_uart_getc(void)
 {
 	u32 ret = get_reg(UART_REG_RXFIFO);
@@ -88,14 +121,17 @@ static int sifive_uart_getc(void)
 static struct sbi_console_device sifive_console = {
 	.name = "sifive_uart",
 	.console_putc = sifive_uart_putc,
+	.console_puts = sifive_uart_puts,
 	.console_getc = sifive_uart_getc
 };
 
-int sifive_uart_init(unsigned long base, u32 in_freq, u32 baudrate)
+int sifive_uart_init(unsigned long base, u32 in_freq, u32 baudrate,
+		     u32 fifo_size)
 {
-	uart_base     = (volatile char *)base;
-	uart_in_freq  = in_freq;
-	uart_baudrate = baudrate;
+	uart_base      = (volatile char *)base;
+	uart_in_freq   = in_freq;
+	uart_baudrate  = baudrate;
+	uart_fifo_size = (fifo_size) ? fifo_size : UART_TXFIFO_SIZE;
 
 	/* Configure baudrate */
 	if (in_freq && baudrate)
@@ -104,8 +140,9 @@ int sifive_uart_init(unsigned long base, u32 in_freq, u32 baudrate)
 	/* Disable interrupts */
 	set_reg(UART_REG_IE, 0);
 
-	/* Enable TX */
-	set_reg(UART_REG_TXCTRL, UART_TXCTRL_TXEN);
+	/* Enable TX, the watermark is pending while the TX FIFO is empty */
+	set_reg(UART_REG_TXCTRL,
+		UART_TXCTRL_TXEN | (1 << UART_TXCTRL_TXCNT_SHIFT));
 
 	/* Enable Rx */
 	set_reg(UART_REG_RXCTRL, UART_RXCTRL_RXEN);
@@ -39,6 +39,12 @@
 #define UART_LSR_DR		0x01	/* Receiver data ready */
 #define UART_LSR_BRK_ERROR_BITS	0x1E	/* BI, FE, PE, OE bits */
 
+#define UART_IIR_FIFO_MASK	0xC0	/* FIFO state bits */
+#define UART_IIR_FIFO_ENABLED	0xC0	/* FIFO enabled and working */
+
+/* Transmit FIFO depth of a 16550A */
+#define UART_16550A_FIFO_SIZE	16
+
 /* The XScale PXA UARTs define these bits */
 #define UART_IER_DMAE		0x80	/* DMA Requests Enable */
 #define UART_IER_UUE		0x40	/* UART Unit Enable */
@@ -86,6 +92,39 @@ static void uart8250_putc(char ch)
 	return uart8250_device_putc(&uart8250_dev, ch);
 }
 
+unsigned long uart8250_device_puts(struct uart8250_device *dev,
+				   const char *str, unsigned long len)
+{
+	unsigned long i = 0;
+	bool cr_sent = false;
+	u32 room;
+	char ch;
+
+	while (i < len) {
+		/* With the FIFO enabled, THRE means the whole FIFO is empty */
+		while ((get_reg(dev, UART_LSR_OFFSET) & UART_LSR_THRE) == 0)
+			;
+
+		for (room = dev->fifo_size; room && i < len; room--) {
+			if (str[i] == '\n' && !cr_sent) {
+				ch = '\r';
+				cr_sent = true;
+			} else {
+				ch = str[i++];
+				cr_sent = false;
+			}
+			set_reg(dev, UART_THR_OFFSET, ch);
+		}
+	}
+
+	return len;
+}
+
+static unsigned long uart8250_puts(const char *str, unsigned long len)
+{
+	return uart8250_device_puts(&uart8250_dev, str, len);
+}
+
 int uart8250_device_getc(struct uart8250_device *dev)
 {
 	if (get_reg(dev, UART_LSR_OFFSET) & UART_LSR_DR)
@@ -101,6 +140,7 @@ static int uart8250_getc(void)
 static struct sbi_console_device uart8250_console = {
 	.name = "uart8250",
 	.console_putc = uart8250_putc,
+	.console_puts = uart8250_puts,
 	.console_getc = uart8250_getc
 };
 
@@ -138,6 +178,12 @@ void uart8250_device_init(struct uart8250_device *dev, unsigned long base,
 	set_reg(dev, UART_LCR_OFFSET, 0x03);
 	/* Enable FIFO */
 	set_reg(dev, UART_FCR_OFFSET, 0x01);
+	/* Only a 16550A or later reports a working FIFO */
+	if ((get_reg(dev, UART_IIR_OFFSET) & UART_IIR_FIFO_MASK) ==
+	    UART_IIR_FIFO_ENABLED)
+		dev->fifo_size = UART_16550A_FIFO_SIZE;
+	else
+		dev->fifo_size = 1;
 	/* No modem control DTR RTS */
 	set_reg(dev, UART_MCR_OFFSET, 0x00);
 	/* Clear line status and read receive buffer */
@@ -148,10 +194,12 @@ void uart8250_device_init(struct uart8250_device *dev, unsigned long base,
 }
 
 int uart8250_init(unsigned long base, u32 in_freq, u32 baudrate, u32 reg_shift,
-		  u32 reg_width, u32 reg_offset, u32 caps)
+		  u32 reg_width, u32 reg_offset, u32 caps, u32 fifo_size)
 {
 	uart8250_device_init(&uart8250_dev, base, in_freq, baudrate,
 			     reg_shift, reg_width, reg_offset, caps);
+	if (fifo_size)
+		uart8250_dev.fifo_size = fifo_size;
 
 	sbi_console_set_device(&uart8250_console);
 
@@ -72,6 +72,7 @@ static bool platform_has_mlevel_imsic = false;
 static u32 generic_hart_index2id[SBI_HARTMASK_MAX_BITS] = { 0 };
 
 static DECLARE_BITMAP(generic_coldboot_harts, SBI_HARTMASK_MAX_BITS);
+static u64 generic_tlbr_flush_limit_val = SBI_PLATFORM_TLB_RANGE_FLUSH_LIMIT_DEFAULT;
 
 /*
  * The fw_platform_coldboot_harts_init() function is called by fw_platform_init()
@@ -126,6 +127,43 @@ default_config:
 	return;
 }
 
+/*
+ * The fw_platform_tlbr_flush_limit_init() function is called by
+ * fw_platform_init() function to apply the DT property
+ * "tlb-range-flush-limit" in "/chosen/opensbi-config" DT node. Without
+ * this property, the TLB range flush limit is left to the boot time
+ * calibration when enabled. A limit set by a platform override is kept
+ * since it works around errata of the SoC.
+ */
+static void fw_platform_tlbr_flush_limit_init(const void *fdt)
+{
+	int chosen_offset, config_offset, len;
+	const fdt32_t *val;
+
+	if (generic_platform_ops.get_tlbr_flush_limit)
+		return;
+
+	chosen_offset = fdt_path_offset(fdt, "/chosen");
+	if (chosen_offset < 0)
+		return;
+
+	config_offset = fdt_node_offset_by_compatible(fdt, chosen_offset,
+						      "opensbi,config");
+	if (config_offset < 0)
+		return;
+
+	val = fdt_getprop(fdt, config_offset, "tlb-range-flush-limit", &len);
+	if (!val || len < sizeof(fdt32_t))
+		return;
+
+	/* Properties are only 32-bit aligned */
+	if (len >= sizeof(fdt64_t))
+		generic_tlbr_flush_limit_val = fdt64_ld((const fdt64_t *)val);
+	else
+		generic_tlbr_flush_limit_val = fdt32_to_cpu(*val);
+	generic_platform_ops.get_tlbr_flush_limit = generic_tlbr_flush_limit;
+}
+
 /*
  * The fw_platform_init() function is called very early on the boot HART
  * OpenSBI reference firmwares so that platform specific code get chance
@@ -189,6 +227,7 @@ unsigned long fw_platform_init(unsigned long arg0, unsigned long arg1,
 	platform.cbom_block_size = cbom_block_size;
 
 	fw_platform_coldboot_harts_init(fdt);
+	fw_platform_tlbr_flush_limit_init(fdt);
 
 	/* Return original FDT pointer */
 	return arg1;
@@ -286,7 +325,7 @@ int generic_domains_init(void)
 
 u64 generic_tlbr_flush_limit(void)
 {
-	return SBI_PLATFORM_TLB_RANGE_FLUSH_LIMIT_DEFAULT;
+	return generic_tlbr_flush_limit_val;
 }
 
 u32 generic_tlb_num_entries(void)
@@ -344,7 +383,6 @@ struct sbi_platform_operations generic_platform_ops = {
 	.irqchip_init		= fdt_irqchip_init,
 	.pmu_init		= generic_pmu_init,
 	.pmu_xlate_to_mhpmevent = generic_pmu_xlate_to_mhpmevent,
-	.get_tlbr_flush_limit	= generic_tlbr_flush_limit,
 	.get_tlb_num_entries	= generic_tlb_num_entries,
 	.timer_init		= fdt_timer_init,
 	.mpxy_init		= generic_mpxy_init,
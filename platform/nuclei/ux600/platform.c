@@ -171,7 +171,7 @@ static int ux600_early_init(bool cold_boot)
 	writel(regval, (void *)(UX600_GPIO_ADDR + UX600_GPIO_IOF_EN_OFS));
 
 	rc = sifive_uart_init(UX600_DEBUG_UART, ux600_clk_freq,
-			      UX600_UART_BAUDRATE);
+			      UX600_UART_BAUDRATE, 0);
 	if (rc)
 		return rc;
 
@@ -78,7 +78,7 @@ static int platform_early_init(bool cold_boot)
 
 	/* Example if the generic UART8250 driver is used */
 	rc = uart8250_init(PLATFORM_UART_ADDR, PLATFORM_UART_INPUT_FREQ,
-			   PLATFORM_UART_BAUDRATE, 0, 1, 0, 0);
+			   PLATFORM_UART_BAUDRATE, 0, 1, 0, 0, 0);
 	if (rc)
 		return rc;
 